@@ -0,0 +1,309 @@
+// Benchmark suite: renders a fixed set of scenes with the main executable, repeats every case and compares
+// the median render times with a stored baseline. Usage:
+//   bench [--repeats=n] [--filter=text] [--baseline=path] [--save=path] [--threshold=fraction]
+// Render time and ray counts are taken from the statistics JSON of the renderer, parsing and output are not timed.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+
+#ifndef RAYTRACER_MAIN
+#define RAYTRACER_MAIN "main"
+#endif
+#ifndef RAYTRACER_SOURCE_DIR
+#define RAYTRACER_SOURCE_DIR "."
+#endif
+
+/// @brief Directory for generated scenes, settings and renders, relative to the working directory
+const std::string BENCH_DIRECTORY = "bench_data";
+
+/// @brief One benchmark: a scene rendered with fixed settings
+struct BenchCase
+{
+    std::string name;
+    /// @brief Scene file, empty for a generated sphere scene
+    std::string scenePath;
+    /// @brief Spheres of the generated scene
+    int generatedSpheres;
+    int width;
+    int height;
+    /// @brief Supersampling steps per axis
+    int steps;
+    int scatter;
+    int bounces;
+};
+
+/// @brief Measured result of a case
+struct BenchResult
+{
+    double medianSeconds = 0;
+    double minSeconds = 0;
+    double megaRaysPerSecond = 0;
+};
+
+/// @brief The suite. Changing a case invalidates its baseline entry, add a new name instead
+const std::vector<BenchCase> BENCH_CASES = {
+    {"cornell_preview", RAYTRACER_SOURCE_DIR "/Templates/cornell.scene", 0, 320, 180, 1, 3, 3},
+    {"cornell_quality", RAYTRACER_SOURCE_DIR "/Templates/cornell.scene", 0, 320, 180, 2, 3, 4},
+    {"test_default", RAYTRACER_SOURCE_DIR "/test.scene", 0, 320, 180, 2, 3, 3},
+    {"spheres_1k", "", 1000, 160, 90, 1, 2, 2},
+    {"spheres_100k", "", 100000, 64, 36, 1, 1, 2},
+    {"spheres_1m", "", 1000000, 32, 18, 1, 1, 1},
+};
+
+/// @brief Writes a scene of randomly placed spheres in a cube above a ground plane, the same for every run.
+/// The cube grows with the sphere count so the density stays the same
+void write_sphere_scene(const std::string &path, int count)
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "BENCH ERROR: UNABLE TO WRITE " << path << std::endl;
+        return;
+    }
+
+    const char *materials[] = {"mirror", "brushed", "black", "red", "green"};
+    const float side = 2.0f * std::cbrt((float)count);
+    std::mt19937 random(count);
+    std::uniform_real_distribution<float> coordinate(-side / 2, side / 2);
+    std::uniform_real_distribution<float> radius(0.2f, 0.6f);
+
+    file << "<scene>\n    <materials>\n"
+         << "        <material id=\"mirror\" color=\"1, 1, 1\" reflection=\"1\" roughness=\"0.1\" />\n"
+         << "        <material id=\"brushed\" color=\"1, 1, 1\" reflection=\"0.7\" roughness=\"0.4\" />\n"
+         << "        <material id=\"black\" color=\"0.2, 0.2, 0.2\" reflection=\"0.4\" roughness=\"0.6\" />\n"
+         << "        <material id=\"red\" color=\"0.5, 0.1, 0.1\" reflection=\"0.6\" roughness=\"0.5\" />\n"
+         << "        <material id=\"green\" color=\"0.3, 0.7, 0.3\" reflection=\"0.3\" roughness=\"0.5\" />\n"
+         << "    </materials>\n    <objects>\n";
+    for (int i = 0; i < count; i++)
+    {
+        float x = coordinate(random);
+        float y = coordinate(random) + side / 2 + 1;
+        float z = coordinate(random);
+        float r = radius(random);
+        file << "        <Sphere position=\"" << x << ", " << y << ", " << z << "\" radius=\"" << r << "\" material=\"" << materials[i % 5] << "\" />\n";
+    }
+    file << "        <Plane position=\"0, 0, 0\" rotation=\"90, 0, 0\" scale=\"" << side << ", " << side << ", " << side << "\" material=\"green\" />\n"
+         << "    </objects>\n"
+         << "    <camera position=\"" << side << ", " << side << ", " << -1.5f * side << "\" lookAt=\"0, " << side / 2 << ", 0\" fieldOfView=\"45\" skybox=\"true\"/>\n"
+         << "</scene>\n";
+}
+
+void write_settings(const std::string &path, const BenchCase &bench, const std::string &outputPath, const std::string &statsPath)
+{
+    std::ofstream file(path);
+    file << "<rendersettings>\n"
+         << "    <resolution x=\"" << bench.width << "\" y=\"" << bench.height << "\" />\n"
+         << "    <outputpath path=\"" << outputPath << "\" />\n"
+         << "    <depth b=\"8\" />\n"
+         << "    <supersampling steps=\"" << bench.steps << "\" smoothing=\"false\" />\n"
+         << "    <scatter base=\"" << bench.scatter << "\" reduction=\"1\" />\n"
+         << "    <bounces count=\"" << bench.bounces << "\" />\n"
+         << "    <statistics json=\"" << statsPath << "\" />\n"
+         << "</rendersettings>\n";
+}
+
+/// @brief Reads a number from the flat statistics JSON of the renderer
+/// @return -1 if the key is missing
+double read_json_number(const std::string &json, const std::string &key)
+{
+    size_t position = json.find("\"" + key + "\":");
+    if (position == std::string::npos)
+    {
+        return -1;
+    }
+    return std::atof(json.c_str() + position + key.size() + 3);
+}
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    size_t half = values.size() / 2;
+    return values.size() % 2 == 1 ? values[half] : 0.5 * (values[half - 1] + values[half]);
+}
+
+/// @brief Renders a case repeatedly
+/// @return false if a render failed
+bool run_case(const BenchCase &bench, int repeats, BenchResult &result)
+{
+    std::string scenePath = bench.scenePath;
+    if (scenePath.empty())
+    {
+        scenePath = BENCH_DIRECTORY + "/spheres_" + std::to_string(bench.generatedSpheres) + ".scene";
+        if (!std::ifstream(scenePath).good())
+        {
+            std::cout << "Generating " << scenePath << std::endl;
+            write_sphere_scene(scenePath, bench.generatedSpheres);
+        }
+    }
+    const std::string base = BENCH_DIRECTORY + "/" + bench.name;
+    write_settings(base + ".xml", bench, base + ".ppm", base + "_stats.json");
+
+    std::vector<double> seconds;
+    double rays = 0;
+    for (int run = 0; run < repeats; run++)
+    {
+        // A stale file from an earlier run must not pass for this one
+        std::filesystem::remove(base + "_stats.json");
+        std::string command = std::string("\"") + RAYTRACER_MAIN + "\" \"" + scenePath + "\" \"" + base + ".xml\" > \"" + base + ".log\" 2>&1";
+        if (std::system(command.c_str()) != 0)
+        {
+            std::cerr << "BENCH ERROR: RENDER FAILED, SEE " << base << ".log" << std::endl;
+            return false;
+        }
+        std::ifstream statsFile(base + "_stats.json");
+        std::stringstream json;
+        json << statsFile.rdbuf();
+        double runSeconds = read_json_number(json.str(), "seconds");
+        if (runSeconds < 0)
+        {
+            std::cerr << "BENCH ERROR: NO STATISTICS IN " << base << "_stats.json" << std::endl;
+            return false;
+        }
+        seconds.push_back(runSeconds);
+        rays = read_json_number(json.str(), "primary_rays") + read_json_number(json.str(), "secondary_rays") +
+               read_json_number(json.str(), "shadow_rays");
+    }
+
+    result.medianSeconds = median(seconds);
+    result.minSeconds = *std::min_element(seconds.begin(), seconds.end());
+    result.megaRaysPerSecond = rays / result.medianSeconds / 1e6;
+    return true;
+}
+
+/// @brief Baseline file: one line per case "name median_seconds min_seconds mrays_per_second", # starts a comment
+std::map<std::string, BenchResult> read_baseline(const std::string &path)
+{
+    std::map<std::string, BenchResult> baseline;
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "BENCH ERROR: UNABLE TO READ BASELINE " << path << std::endl;
+        return baseline;
+    }
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string name;
+        BenchResult result;
+        if (fields >> name >> result.medianSeconds >> result.minSeconds >> result.megaRaysPerSecond)
+        {
+            baseline[name] = result;
+        }
+    }
+    return baseline;
+}
+
+void write_baseline(const std::string &path, const std::vector<std::pair<std::string, BenchResult>> &results)
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "BENCH ERROR: UNABLE TO WRITE BASELINE " << path << std::endl;
+        return;
+    }
+    file << "# name median_seconds min_seconds mrays_per_second\n";
+    for (const auto &[name, result] : results)
+    {
+        file << name << " " << result.medianSeconds << " " << result.minSeconds << " " << result.megaRaysPerSecond << "\n";
+    }
+    std::cout << "Baseline written to " << path << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int repeats = 5;
+    std::string filter;
+    std::string baselinePath = RAYTRACER_SOURCE_DIR "/Bench/baseline.txt";
+    std::string savePath;
+    double threshold = 0.1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string flag = argv[i];
+        if (flag.rfind("--repeats=", 0) == 0)
+        {
+            repeats = std::max(std::atoi(flag.c_str() + 10), 1);
+        }
+        else if (flag.rfind("--filter=", 0) == 0)
+        {
+            filter = flag.substr(9);
+        }
+        else if (flag.rfind("--baseline=", 0) == 0)
+        {
+            baselinePath = flag.substr(11);
+        }
+        else if (flag.rfind("--save=", 0) == 0)
+        {
+            savePath = flag.substr(7);
+        }
+        else if (flag.rfind("--threshold=", 0) == 0)
+        {
+            threshold = std::atof(flag.c_str() + 12);
+        }
+        else
+        {
+            std::cerr << "ARGUMENT ERROR: UNKNOWN FLAG " << flag << std::endl;
+            return 1;
+        }
+    }
+
+    std::filesystem::create_directories(BENCH_DIRECTORY);
+    std::map<std::string, BenchResult> baseline = read_baseline(baselinePath);
+
+    std::cout << "case                median [s]   min [s]   Mrays/s   baseline min [s]   change" << std::endl;
+    std::vector<std::pair<std::string, BenchResult>> results;
+    int regressions = 0;
+    for (const BenchCase &bench : BENCH_CASES)
+    {
+        if (bench.name.find(filter) == std::string::npos)
+        {
+            continue;
+        }
+        BenchResult result;
+        if (!run_case(bench, repeats, result))
+        {
+            return 1;
+        }
+        results.push_back({bench.name, result});
+
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-18s %11.4f %9.4f %9.4f", bench.name.c_str(), result.medianSeconds, result.minSeconds, result.megaRaysPerSecond);
+        std::cout << line;
+        auto reference = baseline.find(bench.name);
+        if (reference != baseline.end())
+        {
+            // Compared by the fastest run, it is the least disturbed by other processes
+            double change = result.minSeconds / reference->second.minSeconds - 1;
+            bool regression = change > threshold;
+            regressions += regression;
+            std::snprintf(line, sizeof(line), " %18.4f %+7.1f%%%s", reference->second.minSeconds, 100 * change, regression ? "  REGRESSION" : "");
+            std::cout << line;
+        }
+        std::cout << std::endl;
+    }
+
+    if (!savePath.empty())
+    {
+        write_baseline(savePath, results);
+    }
+    if (regressions > 0)
+    {
+        std::cout << regressions << " case(s) slower than the baseline by more than " << 100 * threshold << "%" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdlib.h>
+#include <cstdlib>
+
+// Cross-platform aligned allocation
+inline char *allocate_aligned(size_t alignment, size_t size)
+{
+#ifdef _WIN32
+    return static_cast<char *>(_aligned_malloc(size, alignment)); // Use _aligned_malloc on Windows
+#else
+    return static_cast<char *>(aligned_alloc(alignment, size)); // Use aligned_alloc on Linux
+#endif
+}
+
+// Cross-platform aligned free
+inline void free_aligned(void *ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr); // Use _aligned_free on Windows
+#else
+    free(ptr); // Use free on Linux
+#endif
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#include <immintrin.h>
+
+/// @brief Position of an object at a frame
+struct Keyframe
+{
+    int frame;
+    __m128 position;
+};
+
+/// @brief Object movement of an animated scene. Objects are addressed by their object id (position in the scene file
+/// starting at 1, baked files continue after the scene objects). Between keyframes the position is interpolated linearly,
+/// before the first and after the last keyframe the object stands still.
+/// Only the positions of the animated objects are written into the baked memory between frames,
+/// everything else stays baked
+class Animation
+{
+private:
+    /// @brief Keyframes of every animated object, sorted by frame
+    std::map<int32_t, std::vector<Keyframe>> tracks;
+    int frameCount = 0;
+
+    /// @brief Baked slot of an animated object, set by Bind
+    struct Binding
+    {
+        const std::vector<Keyframe> *keyframes;
+        float *slot;
+    };
+    std::vector<Binding> bindings;
+    /// @brief True if any bound object is a sphere, the sphere BVH then has to follow
+    bool movesSpheres = false;
+
+    static __m128 PositionAt(const std::vector<Keyframe> &keyframes, int frame)
+    {
+        auto next = std::lower_bound(keyframes.begin(), keyframes.end(), frame, [](const Keyframe &k, int f)
+                                     { return k.frame < f; });
+        if (next == keyframes.begin())
+        {
+            return keyframes.front().position;
+        }
+        if (next == keyframes.end())
+        {
+            return keyframes.back().position;
+        }
+        if (next->frame == frame)
+        {
+            // Exactly the keyframe, (b - a) * 1 + a is not always b
+            return next->position;
+        }
+        const Keyframe &previous = *(next - 1);
+        float t = (float)(frame - previous.frame) / (next->frame - previous.frame);
+        return fmadd(_mm_sub_ps(next->position, previous.position), _mm_set1_ps(t), previous.position);
+    }
+
+public:
+    /// @brief True if the scene has any keyframes, the renderer then writes one image per frame
+    bool Active() const { return !tracks.empty(); }
+
+    /// @brief Frames to render: the frames attribute, or up to the last keyframe
+    int Frames() const
+    {
+        int last = 0;
+        for (const auto &[id, keyframes] : tracks)
+        {
+            last = std::max(last, keyframes.back().frame + 1);
+        }
+        return frameCount > 0 ? frameCount : last;
+    }
+
+    void SetFrames(int frames) { frameCount = frames; }
+
+    void AddKeyframe(int32_t objectId, int frame, __m128 position)
+    {
+        std::vector<Keyframe> &keyframes = tracks[objectId];
+        Keyframe keyframe = {frame, _mm_blend_ps(position, _mm_setzero_ps(), 0b1000)};
+        auto at = std::lower_bound(keyframes.begin(), keyframes.end(), frame, [](const Keyframe &k, int f)
+                                   { return k.frame < f; });
+        if (at != keyframes.end() && at->frame == frame)
+        {
+            *at = keyframe;
+        }
+        else
+        {
+            keyframes.insert(at, keyframe);
+        }
+    }
+
+    /// @brief Reads a transform stream: one keyframe per line, "frame object x y z". # starts a comment
+    /// @return false if the file could not be read
+    bool LoadStream(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line))
+        {
+            lineNumber++;
+            line = line.substr(0, line.find('#'));
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue;
+            }
+            std::istringstream fields(line);
+            int frame;
+            int32_t objectId;
+            float x, y, z;
+            if (!(fields >> frame >> objectId >> x >> y >> z))
+            {
+                std::cerr << "SCENE ERROR: INVALID TRANSFORM IN LINE " << lineNumber << " OF " << path << std::endl;
+                continue;
+            }
+            AddKeyframe(objectId, frame, _mm_set_ps(0, z, y, x));
+        }
+        return true;
+    }
+
+    /// @brief Finds the baked slots of the animated objects, once per baked scene
+    void Bind(const BakedScene &scene)
+    {
+        bindings.clear();
+        movesSpheres = false;
+        const size_t objectCount = scene.sphereCount + scene.planeCount;
+        for (size_t i = 0; i < objectCount; i++)
+        {
+            float *slot = scene.memory + 28 * i;
+            int32_t id;
+            std::memcpy(&id, slot + 27, 4);
+            auto track = tracks.find(id);
+            if (track != tracks.end())
+            {
+                bindings.push_back({&track->second, slot});
+                movesSpheres |= i < scene.sphereCount;
+            }
+        }
+        if (bindings.size() < tracks.size())
+        {
+            std::cerr << "SCENE ERROR: " << tracks.size() - bindings.size() << " ANIMATED OBJECT IDS NOT IN THE SCENE" << std::endl;
+        }
+    }
+
+    /// @brief True if Apply moves spheres, the sphere blocks and the BVH have to be updated after it (update_sphere_bvh)
+    bool MovesSpheres() const { return movesSpheres; }
+
+    /// @brief Moves the animated objects to their position at the frame, in the baked memory of the last Bind
+    void Apply(int frame) const
+    {
+        for (const Binding &binding : bindings)
+        {
+            _mm_store_ps(binding.slot, PositionAt(*binding.keyframes, frame));
+        }
+    }
+};
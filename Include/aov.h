@@ -0,0 +1,168 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include <immintrin.h>
+
+/// @brief First surface a camera ray hits, reported by FullTrace for the auxiliary outputs
+struct FirstHit
+{
+    /// @brief Normal of the hit, 0 for the background
+    __m128 normal;
+    /// @brief Color of the hit object, 1 for the background and emissive objects
+    __m128 albedo;
+    /// @brief Distance to the hit, NO_HIT_DISTANCE for the background
+    float depth;
+    /// @brief Position of the object in the scene file starting at 1, 0 for the background
+    int32_t objectId;
+};
+
+/// @brief Auxiliary output buffers (AOVs), filled by the kernels in the main pass. Row major, one entry per pixel.
+/// Buffers that are neither written nor needed by the denoiser stay nullptr
+class AovBuffers
+{
+public:
+    /// @brief Mean normal of the first hits, not renormalized
+    __m128 *normal = nullptr;
+    /// @brief Mean albedo of the first hits
+    __m128 *albedo = nullptr;
+    /// @brief Closest first hit
+    float *depth = nullptr;
+    /// @brief Object of the closest first hit
+    int32_t *objectId = nullptr;
+    /// @brief First hits recorded, allocated whenever any of the hit buffers is
+    int32_t *samples = nullptr;
+    /// @brief Render time spent on the pixel
+    float *seconds = nullptr;
+
+    /// @brief True if the kernels have to report their first hits
+    bool RecordsHits() const { return samples != nullptr; }
+
+    /// @brief Guide buffers for the denoiser, valid while the normal buffer is allocated
+    DenoiseFeatures Features() const { return {normal, albedo, depth}; }
+
+    /// @brief Allocates and clears the buffers the settings ask for
+    void Allocate(const RenderSettings &settings)
+    {
+        const size_t pixelCount = (size_t)settings.resolution[0] * settings.resolution[1];
+        const bool features = settings.denoise || !settings.aov_normal_path.empty() || !settings.aov_albedo_path.empty();
+        const bool closest = features || !settings.aov_depth_path.empty() || !settings.aov_objectid_path.empty();
+
+        if (features)
+        {
+            normal = (__m128 *)allocate_aligned(16, pixelCount * sizeof(__m128));
+            albedo = (__m128 *)allocate_aligned(16, pixelCount * sizeof(__m128));
+        }
+        if (closest)
+        {
+            depth = (float *)allocate_aligned(16, pixelCount * sizeof(float));
+        }
+        if (!settings.aov_objectid_path.empty())
+        {
+            objectId = (int32_t *)allocate_aligned(16, pixelCount * sizeof(int32_t));
+        }
+        if (closest || !settings.aov_samples_path.empty())
+        {
+            samples = (int32_t *)allocate_aligned(16, pixelCount * sizeof(int32_t));
+        }
+        if (!settings.aov_time_path.empty())
+        {
+            seconds = (float *)allocate_aligned(16, pixelCount * sizeof(float));
+        }
+        Clear(pixelCount);
+    }
+
+    /// @brief Resets the allocated buffers for the next image, e.g. the next animation frame
+    void Clear(size_t pixelCount)
+    {
+        if (normal != nullptr)
+        {
+            std::memset((void *)normal, 0, pixelCount * sizeof(__m128));
+            std::memset((void *)albedo, 0, pixelCount * sizeof(__m128));
+        }
+        if (depth != nullptr)
+        {
+            std::fill(depth, depth + pixelCount, NO_HIT_DISTANCE);
+        }
+        if (objectId != nullptr)
+        {
+            std::memset(objectId, 0, pixelCount * sizeof(int32_t));
+        }
+        if (samples != nullptr)
+        {
+            std::memset(samples, 0, pixelCount * sizeof(int32_t));
+        }
+        if (seconds != nullptr)
+        {
+            std::memset(seconds, 0, pixelCount * sizeof(float));
+        }
+    }
+
+    /// @brief Adds the first hit of one sample of a pixel. Normal and albedo are kept as running means,
+    /// so they are usable at any time, e.g. for denoised previews
+    inline void Add(int pixel, const FirstHit &hit)
+    {
+        int count = ++samples[pixel];
+        if (normal != nullptr)
+        {
+            __m128 weight = _mm_set1_ps(1.0f / count);
+            normal[pixel] = fmadd(_mm_sub_ps(hit.normal, normal[pixel]), weight, normal[pixel]);
+            albedo[pixel] = fmadd(_mm_sub_ps(hit.albedo, albedo[pixel]), weight, albedo[pixel]);
+        }
+        if (depth != nullptr && hit.depth < depth[pixel])
+        {
+            depth[pixel] = hit.depth;
+            if (objectId != nullptr)
+            {
+                objectId[pixel] = hit.objectId;
+            }
+        }
+    }
+
+    /// @brief Writes every buffer that has an output path as a Portable Float Map
+    void Write(const RenderSettings &settings) const
+    {
+        const int width = settings.resolution[0];
+        const int height = settings.resolution[1];
+        if (!settings.aov_normal_path.empty())
+        {
+            write_pfm(settings.aov_normal_path, (const float *)normal, 3, 4, width, height);
+        }
+        if (!settings.aov_albedo_path.empty())
+        {
+            write_pfm(settings.aov_albedo_path, (const float *)albedo, 3, 4, width, height);
+        }
+        if (!settings.aov_depth_path.empty())
+        {
+            write_pfm(settings.aov_depth_path, depth, 1, 1, width, height);
+        }
+        if (!settings.aov_objectid_path.empty())
+        {
+            std::vector<float> ids(objectId, objectId + (size_t)width * height);
+            write_pfm(settings.aov_objectid_path, ids.data(), 1, 1, width, height);
+        }
+        if (!settings.aov_samples_path.empty())
+        {
+            std::vector<float> counts(samples, samples + (size_t)width * height);
+            write_pfm(settings.aov_samples_path, counts.data(), 1, 1, width, height);
+        }
+        if (!settings.aov_time_path.empty())
+        {
+            write_pfm(settings.aov_time_path, seconds, 1, 1, width, height);
+        }
+    }
+
+    /// @brief Frees all buffers
+    void Free()
+    {
+        for (void *buffer : {(void *)normal, (void *)albedo, (void *)depth, (void *)objectId, (void *)samples, (void *)seconds})
+        {
+            if (buffer != nullptr)
+            {
+                free_aligned(buffer);
+            }
+        }
+        *this = AovBuffers();
+    }
+};
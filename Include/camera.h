@@ -9,6 +9,11 @@
 using namespace std;
 using namespace m128Calc;
 
+/// @brief Pixels per tile side of the grid and progressive render loops, a tile is the unit of work of a thread
+const int RENDER_TILE_SIZE = 16;
+/// @brief Active pixels per unit of work in adaptive sampling
+const int ADAPTIVE_CHUNK_SIZE = 64;
+
 class Scene;
 
 class Camera
@@ -16,40 +21,42 @@ class Camera
     // Determines the color value for each pixel
     using RenderKernel = __m128 (*)(Camera *cam, int x, int y);
 
-private:
-    /// @brief Seed vector for randomness
-    __m128i rng_seed;
+public:
+    /// @brief Template argument value for settings that are read at runtime instead of being compile-time constants
+    static constexpr int RUNTIME = -1;
 
+private:
     /// @brief Generates the full recursion for a single ray
     /// @param scene active scene
     /// @param bounces How many times the ray can bounce before it is interrupted
     /// @param scatter Into how many rays does the ray scatter on impact?
     /// @param scatterreduction How many scatter rays to lose after each bounce
-    /// @param sceneMem Pointer to the start of baked scene memory
+    /// @param sceneMem Baked scene memory
+    /// @param sampler Random numbers of the current pixel sample
+    /// @param bsdfPdf Density the ray was scattered with, if the last hit also sampled the lights directly. Emission found by the ray
+    /// is then weighted against light sampling (multiple importance sampling). 0 counts emission fully
+    /// @param firstHit Receives the surface the ray hits for the auxiliary outputs, nullptr if not needed. Only set by camera rays
+    /// @tparam Bounces Compile-time bounce count, overrides the bounces parameter. RUNTIME uses the parameter
     /// @return
-    __m128 FullTrace(LightRay lr, int bounces, int scatters, int scatterreduction, float *sceneMem)
+    template <int Bounces = RUNTIME>
+    __m128 FullTrace(LightRay lr, int bounces, int scatters, int scatterreduction, const BakedScene &sceneMem, Sampler &sampler, float bsdfPdf = 0.0f, FirstHit *firstHit = nullptr)
     {
-        // Check Object Collisions
-        Collision closestCollision = NO_COLLISION;
-        float closestDistance = INFINITY;
-        float *closest_obj_ptr = 0;
-
-        for (size_t i = 0; i < activeScene.objects.size(); i++)
+        // Recursion depth known at compile time: the bounce check folds away and every level is inlinable
+        constexpr int NextBounces = (Bounces == RUNTIME) ? RUNTIME : std::max(Bounces - 1, 0);
+        if constexpr (Bounces != RUNTIME)
         {
-            float *objOffset = sceneMem + (28 * i);
-            Collision c = MemoryCollision(lr, objOffset); // Kollision prüfen
-            if (c.valid && c.distance < closestDistance)  // wenn Kollision gültig und Objekt näher ist als Vorherige
-            {
-                closestDistance = c.distance;
-                closest_obj_ptr = objOffset;
-                closestCollision = c;
-            }
-            else
-            {
-                continue;
-            }
+            bounces = Bounces;
         }
 
+        // Camera rays start with all bounces left
+        RenderStats &stats = LocalStats();
+        const int depth = this->bounces - bounces;
+        (depth == 0 ? stats.primaryRays : stats.secondaryRays)++;
+
+        // Check Object Collisions, one loop per object type
+        const float *closest_obj_ptr;
+        Collision closestCollision = activeKernels.memoryCollision(lr, sceneMem, closest_obj_ptr);
+
         if (closestCollision.valid) // wenn Kollision gefunden
         {
             // Objekteigenschaften auslesen
@@ -59,15 +66,31 @@ private:
             // Scatter and bounce
             __m128 objCol = _mm_load_ps(closest_obj_ptr + 20);
 
+            if (firstHit != nullptr)
+            {
+                firstHit->normal = closestCollision.normal;
+                firstHit->albedo = diffuse < 0 ? _mm_set1_ps(1.0f) : objCol;
+                firstHit->depth = closestCollision.distance;
+                std::memcpy(&firstHit->objectId, closest_obj_ptr + 27, 4);
+            }
+
             if (diffuse < 0)
             {
                 // For emissive materials, Rückgabe Emissionsfarbe
+                stats.EndPath(depth);
+                if (bsdfPdf > 0)
+                {
+                    // Light was also sampled directly at the last hit: balance heuristic
+                    float lightPdf = LightSelectionPdf(sceneMem) * LightPdf(closest_obj_ptr, lr.origin, lr.direction, closestCollision.distance);
+                    return _mm_mul_ps(objCol, _mm_set1_ps(bsdfPdf / (bsdfPdf + lightPdf)));
+                }
                 return objCol;
             }
             // wenn Material diffus & nicht emissiv
             __m128 resColor = _mm_setzero_ps();
             if (bounces == 0)
             {
+                stats.EndPath(depth);
                 return resColor;
             }
 
@@ -84,37 +107,57 @@ private:
             // Spiegel-Reflektion
             for (; s < scatters_specular; s++)
             {
-                __m128 specular_reflected = normalized(
-                    scatter(
-                        mirrorToNormalized(
-                            closestCollision.incoming_direction,
-                            closestCollision.normal),
-                        diffuse,
-                        rng_seed)); // Spiegelung plus zufällige Streuung
+                __m128 specular_reflected = activeKernels.specularScatter(
+                    closestCollision.incoming_direction,
+                    closestCollision.normal,
+                    diffuse,
+                    sampler.Next()); // Spiegelung plus zufällige Streuung
 
                 __m128 hit_color = _mm_mul_ps(
                     objCol,
-                    FullTrace(LightRay(closestCollision.point, specular_reflected),
+                    FullTrace<NextBounces>(LightRay(closestCollision.point, specular_reflected),
                               bounces - 1,
                               scatters - scatterreduction,
                               scatterreduction,
-                              sceneMem)); // Rekursion mit kleinerer bounces- und scatter-Anzahl
+                              sceneMem,
+                              sampler)); // Rekursion mit kleinerer bounces- und scatter-Anzahl
                 col_specular = _mm_add_ps(col_specular, hit_color);
             }
 
             // Diffuse Reflektion
-            for (; s < scatters + 1; s++)
+            const bool sampleLights = LightSourceCount(sceneMem) > 0;
+            __m128 diffuse_directions[4];
+            for (int d = 0; s < scatters + 1; s++, d++)
             {
-                __m128 diffuse_reflected = diffuseScatter(closestCollision.normal, rng_seed);
+                // Directions are generated four at a time, each direction takes a pair of dimensions (0, 1 or 2, 3) of one sampler group
+                if ((d & 3) == 0)
+                {
+                    __m128 a = sampler.Next();
+                    __m128 b = sampler.Next();
+                    __m128 u1 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+                    __m128 u2 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+                    activeKernels.diffuseScatter(closestCollision.normal, u1, u2, diffuse_directions);
+                }
+                __m128 diffuse_reflected = diffuse_directions[d & 3];
+                // Cosine distributed, pdf = cos / pi
+                float diffusePdf = sampleLights ? std::max(dot(diffuse_reflected, closestCollision.normal), 1e-6f) * (1.0f / 3.1415926535f) : 0.0f;
 
                 __m128 hit_color = _mm_mul_ps(
                     objCol,
-                    FullTrace(LightRay(closestCollision.point, diffuse_reflected),
+                    FullTrace<NextBounces>(LightRay(closestCollision.point, diffuse_reflected),
                               bounces - 1,
                               scatters - scatterreduction,
                               scatterreduction,
-                              sceneMem)); // Rekursion mit kleinerer bounces- und scatter-Anzahl
+                              sceneMem,
+                              sampler,
+                              diffusePdf)); // Rekursion mit kleinerer bounces- und scatter-Anzahl
                 col_diffuse = _mm_add_ps(col_diffuse, hit_color);
+
+                if (sampleLights)
+                {
+                    // Next event estimation: sample a light directly instead of hoping the diffuse ray hits one
+                    col_diffuse = _mm_add_ps(col_diffuse, _mm_mul_ps(objCol, SampleDirectLight(closestCollision, sceneMem, sampler)));
+                }
             }
 
             // Reflektierte Strahlen mitteln
@@ -130,9 +173,85 @@ private:
         }
         else // wenn keine Kollision gefunden, Farbe des Hintergrundes berechnen
         {
-            float gradient_pos = (getY(lr.direction) * 0.5f) + 0.5f;
-            return get_gradient(skybox_colors, skybox_marks, gradient_pos);
+            if (firstHit != nullptr)
+            {
+                *firstHit = {_mm_setzero_ps(), _mm_set1_ps(1.0f), NO_HIT_DISTANCE, 0};
+            }
+            stats.EndPath(depth);
+            __m128 background = Background(lr.direction);
+            if (bsdfPdf > 0 && environment != nullptr && environment->CanSample())
+            {
+                // Environment was also sampled directly at the last hit: balance heuristic
+                float lightPdf = LightSelectionPdf(sceneMem) * environment->Pdf(lr.direction);
+                background = _mm_mul_ps(background, _mm_set1_ps(bsdfPdf / (bsdfPdf + lightPdf)));
+            }
+            return background;
+        }
+    }
+
+    /// @brief Light sources next event estimation chooses from: emissive objects plus the environment map
+    inline size_t LightSourceCount(const BakedScene &sceneMem) const
+    {
+        return sceneMem.lightCount + (environment != nullptr && environment->CanSample() ? 1 : 0);
+    }
+
+    /// @brief Probability of choosing one specific light source, they are chosen uniformly
+    inline float LightSelectionPdf(const BakedScene &sceneMem) const
+    {
+        return 1.0f / LightSourceCount(sceneMem);
+    }
+
+    /// @brief Direct light at a diffuse hit: picks one light source, samples a direction towards it and casts a shadow ray.
+    /// Weighted against the diffuse ray hitting the same light with the balance heuristic
+    /// @param hit Diffuse hit, normal faces the incoming ray
+    /// @return Incoming radiance times cosine over pdf and MIS weight, to be multiplied with the material color
+    __m128 SampleDirectLight(const Collision &hit, const BakedScene &sceneMem, Sampler &sampler)
+    {
+        __m128 u = sampler.Next();
+        float u0 = getX(u);
+        float u1 = getY(u);
+        float u2 = getZ(u);
+
+        size_t sourceCount = LightSourceCount(sceneMem);
+        size_t source = std::min((size_t)(u0 * sourceCount), sourceCount - 1);
+
+        __m128 direction, radiance;
+        float pdf, distance;
+        if (source < sceneMem.lightCount)
+        {
+            const float *light = sceneMem.lights[source];
+            LightSample sample = SampleLight(light, hit.point, u1, u2);
+            direction = sample.direction;
+            radiance = _mm_load_ps(light + 20);
+            pdf = sample.pdf;
+            distance = sample.distance * 0.999f; // The light itself does not block
         }
+        else
+        {
+            EnvironmentSample sample = environment->Sample(u1, u2);
+            direction = sample.direction;
+            radiance = sample.radiance;
+            pdf = sample.pdf;
+            distance = NO_HIT_DISTANCE; // Infinitely far away, any hit blocks it
+        }
+
+        float cosTheta = dot(direction, hit.normal);
+        if (cosTheta <= 0 || pdf <= 0)
+        {
+            return _mm_setzero_ps();
+        }
+
+        // Shadow ray, only needs to know if anything is in front of the light
+        LocalStats().shadowRays++;
+        if (activeKernels.memoryOcclusion(LightRay(hit.point, direction), sceneMem, distance))
+        {
+            return _mm_setzero_ps();
+        }
+
+        // Radiance * (cos / pi) / lightPdf * lightPdf / (lightPdf + bsdfPdf), with bsdfPdf = cos / pi
+        float lightPdf = pdf / sourceCount;
+        float bsdfPdf = cosTheta * (1.0f / 3.1415926535f);
+        return _mm_mul_ps(radiance, _mm_set1_ps(bsdfPdf / (lightPdf + bsdfPdf)));
     }
 
 protected:
@@ -144,20 +263,73 @@ protected:
     __m128 lookAt;
     float fieldOfView;
     Scene activeScene;
-    float *sceneMemory;
+    BakedScene sceneMemory;
     int bounces;
     int scatterCount;
     int scatterRedux;
+    /// @brief Start of RenderImage, the time budget is measured from here
+    double renderStartTime = 0;
+    /// @brief Auxiliary outputs and denoiser guide buffers, only allocated while rendering with them enabled
+    AovBuffers aovs;
+
+    /// @brief Ray direction (not normalized) through the center of pixel (0, 0)
+    __m128 pixelOrigin;
+    /// @brief Change of the ray direction per pixel in x direction
+    __m128 pixelStepX;
+    /// @brief Change of the ray direction per pixel in y direction
+    __m128 pixelStepY;
+
+    /// @brief Computes the camera frame and the per pixel step vectors once, so ray generation is only two FMAs and a normalization
+    void PrecomputeFrame()
+    {
+        // Direction of the camera (forward vector)
+        __m128 forward = normalized(_mm_sub_ps(lookAt, position));
+
+        // Right and up vectors for the camera coordinate system
+        __m128 upReference = (abs(getY(forward)) > 0.99f) ? Vec3(0, 0, 1).data : Vec3(0, 1, 0).data;
+        __m128 right = normalized(cross(forward, upReference));
+        __m128 up = normalized(cross(right, forward));
+
+        // Field of view and aspect ratio
+        float aspectRatio = static_cast<float>(renderSettings.resolution[0]) / renderSettings.resolution[1];
+        float fovY = std::tan((fieldOfView * 0.5f) * (3.1415926535f / 180.0f));
+        float fovX = fovY * aspectRatio;
+
+        // Screen space coordinate of a pixel: (2 * (x + 0.5) / width - 1) * fovX, (1 - 2 * (y + 0.5) / height) * fovY
+        float stepX = 2.0f * fovX / renderSettings.resolution[0];
+        float stepY = -2.0f * fovY / renderSettings.resolution[1];
+        float originX = 0.5f * stepX - fovX;
+        float originY = 0.5f * stepY + fovY;
+
+        pixelStepX = _mm_mul_ps(right, _mm_set1_ps(stepX));
+        pixelStepY = _mm_mul_ps(up, _mm_set1_ps(stepY));
+        pixelOrigin = fmadd(right, _mm_set1_ps(originX), fmadd(up, _mm_set1_ps(originY), forward));
+    }
 
 public:
-    __m128 *skybox_colors;
+    /// @brief Skybox gradient baked at camera setup
+    SkyboxLUT skybox;
+
+    /// @brief HDR environment map, replaces the skybox if set
+    EnvironmentMap *environment = nullptr;
+
+    /// @brief Background color in the given direction: environment map or skybox
+    inline __m128 Background(__m128 direction) const
+    {
+        return environment != nullptr ? environment->Lookup(direction) : skybox.Lookup(direction);
+    }
 
-    std::vector<float> skybox_marks = {
-        0.0f, 0.15f, 0.46f, 0.52f, 0.6f, 1.1f};
     /// @param position World position of the camera
     /// @param lookAt World position thats in the center of the rendered image
     /// @param fieldOfView Vertical FOV of the Camera in Degrees
-    Camera(const Vec3 &position, const Vec3 &lookAt, float fieldOfView, const RenderSettings &rs, const Scene &activeScene, bool skybox)
+    /// @param skybox false: black background, true: gradient background
+    /// @param gradientMarks Positions of the skybox gradient colors in [0, 1] (bottom to top). Empty uses the default sunset gradient
+    /// @param gradientColors Colors of the skybox gradient, one per mark
+    /// @param environmentPath Equirectangular .pfm or .hdr environment map, replaces the skybox. Empty for none
+    /// @param environmentIntensity Multiplier for the environment map radiance
+    Camera(const Vec3 &position, const Vec3 &lookAt, float fieldOfView, const RenderSettings &rs, const Scene &activeScene, bool skybox,
+           std::vector<float> gradientMarks = {}, std::vector<Vec3> gradientColors = {},
+           const std::string &environmentPath = "", float environmentIntensity = 1.0f)
     {
         this->position = position.data;
         this->lookAt = lookAt.data;
@@ -169,69 +341,474 @@ public:
         scatterCount = rs.scatterbase;
         scatterRedux = rs.scatterredux;
 
-        rng_seed = _mm_set_epi32(82, 42, 69, 2004);
+        PrecomputeFrame();
 
         // Skybox
-        if (skybox)
+        if (!skybox)
         {
-            skybox_colors = (__m128 *)allocate_aligned(16, 6 * 16);
-            skybox_colors[0] = Vec3{0.0f, 0.02f, 0.08f}.data;
-            skybox_colors[1] = Vec3{0.3f, 0.2f, 0.5f}.data;
-            skybox_colors[2] = Vec3{0.8314f, 0.8118f, 0.7922f}.data;
-            skybox_colors[3] = Vec3{0.9331f, 0.8118f, 0.3922f}.data;
-            skybox_colors[4] = Vec3{0.8039f, 0.8667f, 0.9294f}.data;
-            skybox_colors[5] = Vec3{0.2353f, 0.2471f, 0.3686f}.data;
+            gradientMarks = {0.0f, 1.1f};
+            gradientColors = {Vec3{0.0f, 0.0f, 0.0f}, Vec3{0.0f, 0.0f, 0.0f}};
+        }
+        else if (gradientMarks.empty())
+        {
+            // Default: sunset
+            gradientMarks = {0.0f, 0.15f, 0.46f, 0.52f, 0.6f, 1.1f};
+            gradientColors = {
+                Vec3{0.0f, 0.02f, 0.08f},
+                Vec3{0.3f, 0.2f, 0.5f},
+                Vec3{0.8314f, 0.8118f, 0.7922f},
+                Vec3{0.9331f, 0.8118f, 0.3922f},
+                Vec3{0.8039f, 0.8667f, 0.9294f},
+                Vec3{0.2353f, 0.2471f, 0.3686f}};
+        }
+
+        __m128 *gradientPoints = (__m128 *)allocate_aligned(16, gradientColors.size() * 16);
+        for (size_t i = 0; i < gradientColors.size(); i++)
+        {
+            gradientPoints[i] = gradientColors[i].data;
+        }
+        this->skybox.Bake(gradientPoints, gradientMarks);
+        free_aligned(gradientPoints);
+
+        if (!environmentPath.empty())
+        {
+            environment = new EnvironmentMap(environmentPath, environmentIntensity);
+            if (!environment->Valid())
+            {
+                delete environment;
+                environment = nullptr;
+            }
+        }
+    }
+
+    ~Camera()
+    {
+        delete environment;
+    }
+
+    Camera(const Camera &) = delete;
+    Camera &operator=(const Camera &) = delete;
+
+    /// @brief Fills the image with one kernel call per pixel
+    /// @param imageData Row major, receives the color of every pixel
+    /// @tparam Kernel Per pixel kernel, a template parameter so it can be inlined into the pixel loop
+    template <RenderKernel Kernel>
+    void SampleGrid(__m128 *imageData)
+    {
+        const int width = renderSettings.resolution[0];
+
+        const bool timePixels = aovs.seconds != nullptr;
+
+        ForEachTile("grid tile", [&](int x, int y)
+        {
+            PROFILE_PIXEL_BEGIN(profileMark);
+            double pixelStart = timePixels ? omp_get_wtime() : 0;
+            imageData[y * width + x] = Kernel(this, x, y);
+            if (timePixels)
+            {
+                aovs.seconds[y * width + x] += (float)(omp_get_wtime() - pixelStart);
+            }
+            PROFILE_PIXEL_END(profileMark, y * width + x);
+        });
+    }
+
+    /// @brief Calls pixel(x, y) for every pixel of the image. Threads take RENDER_TILE_SIZE tiles one at a time,
+    /// each tile is a span in the trace
+    template <typename PixelFunction>
+    void ForEachTile(const char *traceName, PixelFunction &&pixel)
+    {
+        const int width = renderSettings.resolution[0];
+        const int height = renderSettings.resolution[1];
+        const int tilesX = (width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+        const int tilesY = (height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+
+#pragma omp parallel for schedule(dynamic)
+        for (int tile = 0; tile < tilesX * tilesY; tile++)
+        {
+            TRACE_SCOPE(traceName, "render", tile);
+            const int x0 = (tile % tilesX) * RENDER_TILE_SIZE;
+            const int y0 = (tile / tilesX) * RENDER_TILE_SIZE;
+            for (int y = y0; y < std::min(y0 + RENDER_TILE_SIZE, height); y++)
+            {
+                for (int x = x0; x < std::min(x0 + RENDER_TILE_SIZE, width); x++)
+                {
+                    pixel(x, y);
+                }
+            }
+        }
+    }
+
+    /// @brief Adaptive sampling. Every pixel gets the minimum samples, after that each pass doubles the samples
+    /// of the pixels whose mean is not accurate enough yet, until the error target, the sample limit or the time limit is reached
+    /// @param imageData Row major, receives the color of every pixel
+    /// @tparam Bounces Compile-time bounce count, RUNTIME uses the settings
+    template <int Bounces = RUNTIME>
+    void SampleAdaptive(__m128 *imageData)
+    {
+        const int width = renderSettings.resolution[0];
+        const int height = renderSettings.resolution[1];
+        const int pixelCount = width * height;
+        const int minSamples = renderSettings.adaptive_min_samples;
+        const int maxSamples = renderSettings.adaptive_max_samples;
+        const double starttime = omp_get_wtime();
+
+        // Running sums per pixel: color in imageData, luminance and squared luminance for the variance
+        std::vector<float> luminanceSum(pixelCount, 0.0f);
+        std::vector<float> luminanceSquares(pixelCount, 0.0f);
+        std::vector<int> samples(pixelCount, 0);
+        std::vector<int> active(pixelCount);
+        for (int p = 0; p < pixelCount; p++)
+        {
+            imageData[p] = _mm_setzero_ps();
+            active[p] = p;
+        }
+
+        const bool timePixels = aovs.seconds != nullptr;
+        double secondsPerSample = 0;
+        for (int pass = 0; !active.empty(); pass++)
+        {
+            // Time limit: shrink the pass so it fits into the remaining time, measured from the previous pass
+            int budgetSamples = maxSamples;
+            if (pass > 0 && renderSettings.adaptive_seconds > 0)
+            {
+                double remaining = renderSettings.adaptive_seconds - (omp_get_wtime() - starttime);
+                budgetSamples = (int)std::min(remaining / (secondsPerSample * active.size()), (double)maxSamples);
+                if (budgetSamples < 1)
+                {
+                    std::cout << "Adaptive sampling stopped by time limit, " << active.size() << " pixels not converged" << std::endl;
+                    break;
+                }
+            }
+
+            double passStart = omp_get_wtime();
+            long long passSamples = 0;
+
+            // Cost per pixel varies a lot, hand out small chunks
+            const int chunks = (int)((active.size() + ADAPTIVE_CHUNK_SIZE - 1) / ADAPTIVE_CHUNK_SIZE);
+#pragma omp parallel for schedule(dynamic) reduction(+ : passSamples)
+            for (int chunk = 0; chunk < chunks; chunk++)
+            {
+                TRACE_SCOPE("adaptive chunk", "render", chunk);
+                for (size_t i = (size_t)chunk * ADAPTIVE_CHUNK_SIZE; i < std::min((size_t)(chunk + 1) * ADAPTIVE_CHUNK_SIZE, active.size()); i++)
+                {
+                    int p = active[i];
+                    int count = (pass == 0) ? minSamples : std::min({samples[p], maxSamples - samples[p], budgetSamples});
+
+                    PROFILE_PIXEL_BEGIN(profileMark);
+                    double pixelStart = timePixels ? omp_get_wtime() : 0;
+                    __m128 colorSum = imageData[p];
+                    float lumSum = luminanceSum[p];
+                    float lumSquares = luminanceSquares[p];
+                    Sampler sampler(p % width, p / width);
+                    for (int s = 0; s < count; s++)
+                    {
+                        sampler.StartSample(samples[p] + s);
+                        __m128 color = kernel_sample<Bounces>(this, p % width, p / width, sampler);
+                        float lum = luminance(color);
+                        colorSum = _mm_add_ps(colorSum, color);
+                        lumSum += lum;
+                        lumSquares += lum * lum;
+                    }
+                    imageData[p] = colorSum;
+                    luminanceSum[p] = lumSum;
+                    luminanceSquares[p] = lumSquares;
+                    samples[p] += count;
+                    passSamples += count;
+                    if (timePixels)
+                    {
+                        aovs.seconds[p] += (float)(omp_get_wtime() - pixelStart);
+                    }
+                    PROFILE_PIXEL_END(profileMark, p);
+                }
+            }
+            secondsPerSample = (omp_get_wtime() - passStart) / std::max(passSamples, 1LL);
+
+            // Keep pixels whose standard error of the mean is above the target
+            std::vector<int> unconverged;
+            for (int p : active)
+            {
+                if (!adaptive_converged(luminanceSum[p], luminanceSquares[p], samples[p], maxSamples, renderSettings.adaptive_error))
+                {
+                    unconverged.push_back(p);
+                }
+            }
+            std::cout << "Adaptive pass " << pass << ": " << passSamples << " samples, " << unconverged.size() << " pixels left" << std::endl;
+            active.swap(unconverged);
+        }
+
+        long long totalSamples = 0;
+        for (int p = 0; p < pixelCount; p++)
+        {
+            imageData[p] = _mm_mul_ps(imageData[p], _mm_set1_ps(1.0f / samples[p]));
+            totalSamples += samples[p];
+        }
+        std::cout << "Average samples per pixel: " << (double)totalSamples / pixelCount << std::endl;
+
+        if (!renderSettings.sample_map_path.empty())
+        {
+            write_sample_map(renderSettings.sample_map_path, samples.data(), width, height, maxSamples);
+        }
+    }
+
+    /// @brief Progressive rendering. Every pass adds one jittered sample per pixel to an accumulation buffer.
+    /// Writes preview images and checkpoints in between, and resumes from the checkpoint if one exists.
+    /// With a time budget, passes stop once the next pass and the output would not finish before the deadline
+    /// @param imageData Row major, receives the color of every pixel
+    /// @tparam Bounces Compile-time bounce count, RUNTIME uses the settings
+    template <int Bounces = RUNTIME>
+    void SampleProgressive(__m128 *imageData)
+    {
+        const int width = renderSettings.resolution[0];
+        const int height = renderSettings.resolution[1];
+        const int pixelCount = width * height;
+        const std::string &checkpoint = renderSettings.checkpoint_path;
+        const uint32_t checkpointKey = checkpoint_key(activeScene.path, renderSettings);
+
+        __m128 *accumulation = (__m128 *)allocate_aligned(16, pixelCount * sizeof(__m128));
+        int passes = 0;
+        if (checkpoint.empty() || !load_checkpoint(checkpoint, accumulation, width, height, passes, checkpointKey))
+        {
+            std::memset((void *)accumulation, 0, pixelCount * sizeof(__m128));
+            passes = 0;
         }
         else
         {
-            skybox_marks = {0.0f, 1.1f};
-            skybox_colors = (__m128 *)allocate_aligned(16, 2 * 16);
-            skybox_colors[0] = Vec3{0.0f, 0.0f, 0.0f}.data;
-            skybox_colors[1] = Vec3{0.0f, 0.0f, 0.0f}.data;
+            std::cout << "Resumed " << passes << " passes from " << checkpoint << std::endl;
+        }
+
+        const double budget = renderSettings.budget_seconds;
+        double passSeconds = 0;   // Slowest pass so far
+        double outputSeconds = 0; // Measured after the first pass, reserved for the final output
+        int passesThisRun = 0;
+
+        const bool timePixels = aovs.seconds != nullptr;
+        // Previews would be image files next to the video, only the checkpoints are written then
+        const bool video = videoOutput.IsOpen();
+        double lastPreview = omp_get_wtime();
+        while (passes < renderSettings.progressive_passes)
+        {
+            if (budget > 0 && passesThisRun > 0)
+            {
+                double remaining = budget - (omp_get_wtime() - renderStartTime);
+                if (passSeconds + outputSeconds > remaining)
+                {
+                    std::cout << "Time budget reached after " << passes << " passes" << std::endl;
+                    break;
+                }
+            }
+
+            double passStart = omp_get_wtime();
+            ForEachTile("progressive tile", [&](int x, int y)
+            {
+                // Pass n is sample n of every pixel, a resumed render continues the sequence
+                PROFILE_PIXEL_BEGIN(profileMark);
+                double pixelStart = timePixels ? omp_get_wtime() : 0;
+                Sampler sampler(x, y);
+                sampler.StartSample(passes);
+                accumulation[y * width + x] = _mm_add_ps(accumulation[y * width + x], kernel_sample<Bounces>(this, x, y, sampler));
+                if (timePixels)
+                {
+                    aovs.seconds[y * width + x] += (float)(omp_get_wtime() - pixelStart);
+                }
+                PROFILE_PIXEL_END(profileMark, y * width + x);
+            });
+            passes++;
+            passesThisRun++;
+            passSeconds = std::max(passSeconds, omp_get_wtime() - passStart);
+
+            if (budget > 0 && passesThisRun == 1)
+            {
+                // Cost of the output phase, measured by writing a first preview (and checkpoint). Reserved with a safety margin.
+                // A video gets no preview frame: the frame is only encoded, plus the slowest write into the video output so far
+                double outputStart = omp_get_wtime();
+                if (!checkpoint.empty())
+                {
+                    save_checkpoint(checkpoint, accumulation, width, height, passes, checkpointKey);
+                }
+                AverageAccumulation(accumulation, passes, imageData);
+                WriteImage(imageData, renderSettings.output_path, false, video ? ImageTarget::Measure : ImageTarget::File);
+                outputSeconds = 1.5 * (omp_get_wtime() - outputStart + videoOutput.SlowestWrite());
+                std::cout << "Budget: " << passSeconds << "s per pass, " << outputSeconds << "s reserved for output" << std::endl;
+            }
+
+            bool previewDue = (renderSettings.preview_passes > 0 && passes % renderSettings.preview_passes == 0) ||
+                              (renderSettings.preview_seconds > 0 && omp_get_wtime() - lastPreview >= renderSettings.preview_seconds);
+            if (previewDue && passes < renderSettings.progressive_passes)
+            {
+                if (!checkpoint.empty())
+                {
+                    save_checkpoint(checkpoint, accumulation, width, height, passes, checkpointKey);
+                }
+                if (!video)
+                {
+                    AverageAccumulation(accumulation, passes, imageData);
+                    WriteImage(imageData, renderSettings.output_path, false);
+                    std::cout << "Preview after " << passes << " passes" << std::endl;
+                }
+                lastPreview = omp_get_wtime();
+            }
+        }
+
+        if (!checkpoint.empty())
+        {
+            save_checkpoint(checkpoint, accumulation, width, height, passes, checkpointKey);
         }
+        AverageAccumulation(accumulation, std::max(passes, 1), imageData);
+        free_aligned(accumulation);
     }
 
-    /// @brief Renders the complete image using the given settings
-    void RenderImage(RenderKernel kernel)
+    /// @brief Divides the accumulated samples by the number of passes
+    void AverageAccumulation(const __m128 *accumulation, int passes, __m128 *imageData)
     {
-        std::string ppm = generate_PPM_header(renderSettings);                                      // Header der PPM-Datei erstellt --> Infos wie Bildauflösung, Channel-Depth
-        const __m128 calculatedChannelDepth = _mm_set_ps1((1 << renderSettings.channel_depth) - 1); // Berechnung Channel-Depth
+        const int pixelCount = renderSettings.resolution[0] * renderSettings.resolution[1];
+        const __m128 scale = _mm_set1_ps(1.0f / passes);
+#pragma omp parallel for
+        for (int p = 0; p < pixelCount; p++)
+        {
+            imageData[p] = _mm_mul_ps(accumulation[p], scale);
+        }
+    }
 
+    /// @brief Renders the complete image using the given settings, or every frame if the scene is animated
+    /// @tparam Sample Fills the image with the color of every pixel, SampleGrid, SampleAdaptive or SampleProgressive
+    template <void (Camera::*Sample)(__m128 *imageData)>
+    void RenderImage()
+    {
         // Prepare Memory
-        double starttime = omp_get_wtime();
+        renderStartTime = omp_get_wtime();
+        double starttime = renderStartTime;
         std::cout << "Starting scene bake..." << std::endl;
-        sceneMemory = bake_into_memory(activeScene.objects);
+        sceneMemory = bake_into_memory(activeScene.objects, activeScene.bakedFiles);
+        tracer.Record("bake", "setup", starttime, omp_get_wtime());
         std::cout << "Baking scene done in " << omp_get_wtime() - starttime << std::endl;
 
-        vector<std::string> rows(renderSettings.resolution[1]); // Speicher für Zeilen des Bildes
+        // Allocate memory for imagedata, row major so rows are contiguous for the quantization kernel
+        const int width = renderSettings.resolution[0];
+        const int height = renderSettings.resolution[1];
+        __m128 *imageData = (__m128 *)allocate_aligned(16, width * height * sizeof(__m128));
 
-        starttime = omp_get_wtime();
+        aovs.Allocate(renderSettings);
 
-        // Allocate memory for imagedata
-        __m128 **imageData = (__m128 **)malloc(renderSettings.resolution[0] * sizeof(__m128 *));
-        __m128 **smoothedImageData = (__m128 **)malloc(renderSettings.resolution[0] * sizeof(__m128 *));
-        for (int x = 0; x < renderSettings.resolution[0]; x++)
+        if (activeScene.animation.Active())
+        {
+            // One image per frame. Baked memory, image and auxiliary buffers and the OpenMP threads are reused,
+            // only the animated objects are moved between frames and the sphere BVH is refitted to them
+            activeScene.animation.Bind(sceneMemory);
+            const RenderSettings still = renderSettings;
+            const int frames = activeScene.animation.Frames();
+            for (int frame = 0; frame < frames; frame++)
+            {
+                TRACE_SCOPE("frame", "animation", frame);
+                renderStartTime = omp_get_wtime();
+                activeScene.animation.Apply(frame);
+                if (activeScene.animation.MovesSpheres() && update_sphere_bvh(sceneMemory, renderSettings.bvh_rebuild_ratio))
+                {
+                    std::cout << "Sphere BVH rebuilt" << std::endl;
+                }
+                tracer.Record("animate", "animation", renderStartTime, omp_get_wtime(), frame);
+                renderSettings = still.ForFrame(frame);
+                if (frame > 0)
+                {
+                    aovs.Clear((size_t)width * height);
+                }
+                std::cout << "Frame " << frame + 1 << " of " << frames << std::endl;
+                RenderFrame<Sample>(imageData);
+            }
+            renderSettings = still;
+        }
+        else
         {
-            imageData[x] = (__m128 *)malloc(renderSettings.resolution[1] * sizeof(__m128));
-            smoothedImageData[x] = (__m128 *)malloc(renderSettings.resolution[1] * sizeof(__m128));
+            RenderFrame<Sample>(imageData);
         }
 
+        // Free all allocated memory
+        free_aligned(imageData);
+        aovs.Free();
+        free_baked_scene(sceneMemory);
+    }
+
+    /// @brief Renders the baked scene into the image buffer and writes the image and auxiliary outputs of the current settings
+    /// @param imageData Row major colors of all pixels, allocated for the full resolution
+    template <void (Camera::*Sample)(__m128 *imageData)>
+    void RenderFrame(__m128 *imageData)
+    {
+        statsRegistry.Reset();
+#ifdef RAYTRACER_PROFILE
+        pixelProfile.Reset(renderSettings.resolution[0], renderSettings.resolution[1]);
+#endif
+
         // Compute color for each pixel
-#pragma omp parallel for collapse(2)
-        for (int y = 0; y < renderSettings.resolution[1]; y++)
+        double starttime = omp_get_wtime();
+        (this->*Sample)(imageData);
+
+        double renderSeconds = omp_get_wtime() - starttime;
+        tracer.Record("render", "render", starttime, starttime + renderSeconds);
+        std::cout << "Rendering done in " << renderSeconds << std::endl;
+        report_render_stats(statsRegistry.Sum(), renderSeconds, renderSettings.stats_json_path);
+
+        WriteImage(imageData, renderSettings.output_path, true, videoOutput.IsOpen() ? ImageTarget::Video : ImageTarget::File);
+        starttime = omp_get_wtime();
+        aovs.Write(renderSettings);
+        tracer.Record("write aovs", "output", starttime, omp_get_wtime());
+#ifdef RAYTRACER_PROFILE
+        pixelProfile.Write(renderSettings.output_path);
+#endif
+
+        if (renderSettings.budget_seconds > 0)
+        {
+            std::cout << "Total time " << omp_get_wtime() - renderStartTime << " of " << renderSettings.budget_seconds << "s budget" << std::endl;
+        }
+    }
+
+    /// @brief Where WriteImage puts the final image
+    enum class ImageTarget
+    {
+        File,   ///< PPM file at the path
+        Video,  ///< Raw frame appended to the video output
+        Measure ///< Encoded like a video frame but not written, to measure the cost of the output
+    };
+
+    /// @brief Post processing and output: denoises and smooths if enabled, scales to the channel depth and writes the PPM file
+    /// @param imageData Row major colors of all pixels, overwritten by the scaled colors
+    /// @param path Output file
+    /// @param printTimings Print the time of every step, off for previews
+    /// @param target PPM file or video frame
+    void WriteImage(__m128 *imageData, const std::string &path, bool printTimings, ImageTarget target = ImageTarget::File)
+    {
+        std::string ppm = generate_PPM_header(renderSettings);                                      // Header der PPM-Datei erstellt --> Infos wie Bildauflösung, Channel-Depth
+        const __m128 calculatedChannelDepth = _mm_set_ps1((1 << renderSettings.channel_depth) - 1); // Berechnung Channel-Depth
+        const int width = renderSettings.resolution[0];
+        const int height = renderSettings.resolution[1];
+
+        vector<std::string> rows(height); // Speicher für Zeilen des Bildes
+
+        double starttime;
+        if (renderSettings.denoise && aovs.normal != nullptr)
         {
-            for (int x = 0; x < renderSettings.resolution[0]; x++)
+            starttime = omp_get_wtime();
+            denoise_atrous(imageData, aovs.Features(), width, height, renderSettings.denoise_iterations,
+                           renderSettings.denoise_sigma_color, renderSettings.denoise_sigma_normal, renderSettings.denoise_sigma_depth);
+            tracer.Record("denoise", "output", starttime, omp_get_wtime());
+            if (printTimings)
             {
-                __m128 kernel_res = kernel(this, x, y);
-                imageData[x][y] = _mm_mul_ps(kernel_res, calculatedChannelDepth);
+                std::cout << "Denoising done in " << (omp_get_wtime() - starttime) << std::endl;
             }
         }
 
-        std::cout << "Rendering done in " << (omp_get_wtime() - starttime) << std::endl;
+#pragma omp parallel for
+        for (int p = 0; p < width * height; p++)
+        {
+            imageData[p] = _mm_mul_ps(imageData[p], calculatedChannelDepth);
+        }
 
+        __m128 *smoothedImageData = nullptr;
         if (renderSettings.smoothing)
         {
             starttime = omp_get_wtime();
+            smoothedImageData = (__m128 *)allocate_aligned(16, width * height * sizeof(__m128));
+
+            // Border pixels are not filtered, keep them unsmoothed
+            std::memcpy(smoothedImageData, imageData, width * height * sizeof(__m128));
 
             // 3x3 Gaussian blur kernel
             const __m128 gaussianKernel[3][3] = {
@@ -240,9 +817,9 @@ public:
                 {_mm_set1_ps(1.0f / 16), _mm_set1_ps(2.0f / 16), _mm_set1_ps(1.0f / 16)}};
 
 #pragma omp parallel for collapse(2)
-            for (int y = 1; y < renderSettings.resolution[1] - 1; y++)
+            for (int y = 1; y < height - 1; y++)
             {
-                for (int x = 1; x < renderSettings.resolution[0] - 1; x++)
+                for (int x = 1; x < width - 1; x++)
                 {
                     __m128 sum = _mm_setzero_ps();
 
@@ -250,65 +827,67 @@ public:
                     {
                         for (int kx = -1; kx <= 1; kx++)
                         {
-                            __m128 pixel = imageData[x + kx][y + ky];
+                            __m128 pixel = imageData[(y + ky) * width + x + kx];
                             sum = _mm_add_ps(sum, _mm_mul_ps(pixel, gaussianKernel[ky + 1][kx + 1]));
                         }
                     }
 
-                    smoothedImageData[x][y] = sum;
+                    smoothedImageData[y * width + x] = sum;
                 }
             }
 
-            std::cout << "Smoothing done in " << (omp_get_wtime() - starttime) << std::endl;
+            tracer.Record("smoothing", "output", starttime, omp_get_wtime());
+            if (printTimings)
+            {
+                std::cout << "Smoothing done in " << (omp_get_wtime() - starttime) << std::endl;
+            }
         }
 
         starttime = omp_get_wtime();
 
+        if (target != ImageTarget::File)
+        {
+            WriteVideoFrame(renderSettings.smoothing ? smoothedImageData : imageData, starttime, printTimings, target == ImageTarget::Video);
+            if (smoothedImageData != nullptr)
+            {
+                free_aligned(smoothedImageData);
+            }
+            return;
+        }
+
         // Bilddaten zu Strings wandeln, Zeilen in werden parallelisiert
 #pragma omp parallel
         {
-            std::vector<char> buffer(renderSettings.resolution[0] * 12); // Preallocate thread-local buffer
+            // Preallocate thread-local buffers. "65535 65535 65535 " needs 18 chars plus terminator per pixel
+            std::vector<char> buffer(width * 19);
+            std::vector<int> channels(width * 3 + 4); // Padding for the vector stores of the quantization kernel
+            const __m128 *finalImage = renderSettings.smoothing ? smoothedImageData : imageData;
+            const int maxChannelValue = (1 << renderSettings.channel_depth) - 1;
             char *buf_ptr;
 
 #pragma omp for
-            for (int y = 0; y < renderSettings.resolution[1]; y++)
+            for (int y = 0; y < height; y++)
             {
+                activeKernels.quantizeRow(finalImage + y * width, width, maxChannelValue, channels.data());
+
                 buf_ptr = buffer.data();
-                for (int x = 0; x < renderSettings.resolution[0]; x++)
+                for (int x = 0; x < width; x++)
                 {
-                    float components[4];
-                    if (renderSettings.smoothing)
-                    {
-                        _mm_storeu_ps(components, smoothedImageData[x][y]);
-                    }
-                    else
-                    {
-                        _mm_storeu_ps(components, imageData[x][y]);
-                    }
-
-                    int r = std::min(255, std::max(0, static_cast<int>(components[0])));
-                    int g = std::min(255, std::max(0, static_cast<int>(components[1])));
-                    int b = std::min(255, std::max(0, static_cast<int>(components[2])));
-
-                    buf_ptr += std::snprintf(buf_ptr, 12, "%d %d %d ", r, g, b);
+                    buf_ptr += std::snprintf(buf_ptr, 19, "%d %d %d ", channels[3 * x], channels[3 * x + 1], channels[3 * x + 2]);
                 }
                 rows[y] = std::string(buffer.data(), buf_ptr - buffer.data());
             }
         }
-        std::cout << "Stringing done in " << (omp_get_wtime() - starttime) << std::endl;
-
-        // Free all allocated memory
-        for (int x = 0; x < renderSettings.resolution[0]; x++)
+        tracer.Record("encode", "output", starttime, omp_get_wtime());
+        if (printTimings)
         {
-            free(imageData[x]);
-            free(smoothedImageData[x]);
+            std::cout << "Stringing done in " << (omp_get_wtime() - starttime) << std::endl;
         }
 
-        free(imageData);
-        free(smoothedImageData);
-
-        free_aligned(sceneMemory);
-        free_aligned(skybox_colors);
+        if (smoothedImageData != nullptr)
+        {
+            free_aligned(smoothedImageData);
+        }
 
         starttime = omp_get_wtime();
 
@@ -317,7 +896,7 @@ public:
             ppm += row + "\n"; // alle Zeilen in rows in PPM-String zusammengefügt
         }
 
-        std::ofstream file(renderSettings.output_path);
+        std::ofstream file(path);
 
         if (file.is_open())
         {
@@ -329,48 +908,73 @@ public:
             std::cerr << "RENDER ERROR: UNABLE TO WRITE" << std::endl;
         }
 
-        std::cout << "Writing to file done in " << omp_get_wtime() - starttime << std::endl;
-
-        return;
+        tracer.Record("write", "output", starttime, omp_get_wtime());
+        if (printTimings)
+        {
+            std::cout << "Writing to file done in " << omp_get_wtime() - starttime << std::endl;
+        }
     }
 
-    /// @param x Sub Pixel Coordinate
-    /// @param y Sub Pixel Coordinate
-    /// @return Light Ray that influences the pixel, direction is normalized
-    LightRay
-    GenerateRayFromPixel(float x, float y)
+    /// @brief Quantizes the image into a raw frame (8 bit per channel, 16 bit big endian for a channel depth of 16)
+    /// and appends it to the video output
+    /// @param finalImage Colors scaled to the channel depth
+    /// @param starttime Start of the encode span
+    /// @param printTimings Print the time of the write
+    /// @param write Off to only encode the frame
+    void WriteVideoFrame(const __m128 *finalImage, double starttime, bool printTimings, bool write)
     {
-        // Direction of the camera (forward vector)
-        __m128 forward = normalized(_mm_sub_ps(lookAt, position));
-
-        // Right and up vectors for the camera coordinate system
-        __m128 upReference = (abs(getY(forward)) > 0.99f) ? Vec3(0, 0, 1).data : Vec3(0, 1, 0).data;
-        __m128 right = normalized(cross(forward, upReference));
-        __m128 up = normalized(cross(right, forward));
+        const int width = renderSettings.resolution[0];
+        const int height = renderSettings.resolution[1];
+        const int maxChannelValue = (1 << renderSettings.channel_depth) - 1;
+        const bool wide = renderSettings.channel_depth == 16;
+        const size_t rowBytes = (size_t)width * 3 * (wide ? 2 : 1);
+        std::vector<uint8_t> frame(rowBytes * height);
 
-        // Field of view and aspect ratio
-        float aspectRatio = static_cast<float>(renderSettings.resolution[0]) / renderSettings.resolution[1];
-        float fovY = std::tan((fieldOfView * 0.5f) * (3.1415926535f / 180.0f));
-        float fovX = fovY * aspectRatio;
-
-        // Normalized device coordinates for the pixel
-        float pixelNDC_X = (x + 0.5f) / renderSettings.resolution[0];
-        float pixelNDC_Y = (y + 0.5f) / renderSettings.resolution[1];
-
-        // Screen space coordinates
-        float pixelScreen_X = (2.0f * pixelNDC_X - 1.0f) * fovX;
-        float pixelScreen_Y = (1.0f - 2.0f * pixelNDC_Y) * fovY;
+#pragma omp parallel
+        {
+            std::vector<int> channels(width * 3 + 4); // Padding for the vector stores of the quantization kernel
 
-        // Prepare SIMD versions of screen coordinates
-        __m128 psx = _mm_set_ps1(pixelScreen_X);
-        __m128 psy = _mm_set_ps1(pixelScreen_Y);
+#pragma omp for
+            for (int y = 0; y < height; y++)
+            {
+                activeKernels.quantizeRow(finalImage + y * width, width, maxChannelValue, channels.data());
+                uint8_t *row = frame.data() + y * rowBytes;
+                for (int c = 0; c < width * 3; c++)
+                {
+                    if (wide)
+                    {
+                        row[2 * c] = (uint8_t)(channels[c] >> 8);
+                        row[2 * c + 1] = (uint8_t)channels[c];
+                    }
+                    else
+                    {
+                        row[c] = (uint8_t)channels[c];
+                    }
+                }
+            }
+        }
+        tracer.Record("encode", "output", starttime, omp_get_wtime());
+        if (!write)
+        {
+            return;
+        }
 
-        // Calculate the direction of the ray
-        __m128 pixelWorld = _mm_fmadd_ps(right, psx, _mm_fmadd_ps(up, psy, forward));
-        __m128 direction = normalized(pixelWorld);
+        starttime = omp_get_wtime();
+        bool written = videoOutput.WriteFrame(frame);
+        tracer.Record("write", "output", starttime, omp_get_wtime());
+        if (printTimings && written)
+        {
+            std::cout << "Frame written to the video output in " << omp_get_wtime() - starttime << std::endl;
+        }
+    }
 
-        // Return the generated ray
-        return LightRay{position, direction};
+    /// @param x Sub Pixel Coordinate
+    /// @param y Sub Pixel Coordinate
+    /// @return Light Ray that influences the pixel, direction is normalized
+    LightRay GenerateRayFromPixel(float x, float y)
+    {
+        __m128 pixelWorld = fmadd(pixelStepX, _mm_set1_ps(x), fmadd(pixelStepY, _mm_set1_ps(y), pixelOrigin));
+        return LightRay{position, normalized(pixelWorld)};
     }
 
     // RENDER KERNELS
@@ -390,9 +994,7 @@ public:
     static __m128 kernel_skyboxOnly(Camera *cam, int x, int y)
     {
         LightRay lr = cam->GenerateRayFromPixel(x, y);
-        const float gradient_pos = (getY(lr.direction) * 0.5f) + 0.5f;
-
-        return get_gradient(cam->skybox_colors, cam->skybox_marks, gradient_pos);
+        return cam->Background(lr.direction);
     }
 
     static __m128 kernel_flatObjects(Camera *cam, int x, int y)
@@ -406,32 +1008,15 @@ public:
                 return _mm_setzero_ps();
             }
         }
-        const float gradient_pos = (getY(lr.direction) * 0.5f) + 0.5f;
-
-        return get_gradient(cam->skybox_colors, cam->skybox_marks, gradient_pos);
+        return cam->Background(lr.direction);
     }
 
     static __m128 kernel_normals(Camera *cam, int x, int y)
     {
         LightRay lr = cam->GenerateRayFromPixel(x, y);
 
-        Collision closestCollision = NO_COLLISION;
-        float closestDistance = 9999;
-
-        for (size_t i = 0; i < cam->activeScene.objects.size(); i++)
-        {
-            float *objOffset = cam->sceneMemory + (28 * i);
-            Collision c = MemoryCollision(lr, objOffset); // Kollision prüfen
-            if (c.valid && c.distance < closestDistance)  // wenn Kollision gültig und Objekt näher ist als Vorherige
-            {
-                closestDistance = c.distance;
-                closestCollision = c;
-            }
-            else
-            {
-                continue;
-            }
-        }
+        const float *closest_obj_ptr;
+        Collision closestCollision = activeKernels.memoryCollision(lr, cam->sceneMemory, closest_obj_ptr);
 
         if (closestCollision.valid)
         {
@@ -440,9 +1025,7 @@ public:
             return col;
         }
 
-        const float gradient_pos = (getY(lr.direction) * 0.5f) + 0.5f;
-
-        return get_gradient(cam->skybox_colors, cam->skybox_marks, gradient_pos);
+        return cam->Background(lr.direction);
     }
 
     /// @brief No scattering, no absorbsion, ten bounces
@@ -468,8 +1051,7 @@ public:
                 continue;
             }
 
-            const float gradient_pos = (getY(lr.direction) * 0.5f) + 0.5f;
-            return get_gradient(cam->skybox_colors, cam->skybox_marks, gradient_pos);
+            return cam->Background(lr.direction);
         }
 
         // Max Bounces
@@ -490,7 +1072,8 @@ public:
                 // jedes Subpixel durch kleine Verschiebungen berechnet --> gleichmäßig verteilte Subpixel-Koordinaten
                 float subpixel_x = fx + i;
                 float subpixel_y = fy + j;
-                final_color = _mm_add_ps(final_color, cam->FullTrace(cam->GenerateRayFromPixel(subpixel_x, subpixel_y), 0, 0, 0, cam->sceneMemory)); // Strahl für jeden Subpixel erzeugt
+                Sampler sampler(x, y);
+                final_color = _mm_add_ps(final_color, cam->FullTrace(cam->GenerateRayFromPixel(subpixel_x, subpixel_y), 0, 0, 0, cam->sceneMemory, sampler)); // Strahl für jeden Subpixel erzeugt
             }
         }
         // kumulierte Farbe durch die Gesamtzahl der Subpixel berechnet
@@ -501,34 +1084,126 @@ public:
 
     static __m128 kernel_scattertest(Camera *cam, int x, int y)
     {
-        return cam->FullTrace(cam->GenerateRayFromPixel(x, y), 5, 10, 4, cam->sceneMemory);
+        Sampler sampler(x, y);
+        return cam->FullTrace(cam->GenerateRayFromPixel(x, y), 5, 10, 4, cam->sceneMemory, sampler);
     }
 
     // berechnet Farbe eines Pixels mit Supersampling
     // Supersampling: verbessert Bildqualität indem mehrere Strahlen pro Pixel simuliert und deren Ergebnisse dann gemittelt werden --> reduziert Bildrauschen und Treppeneffekte bei scharfen Kanten (Aliasing)
+    /// @tparam Steps Compile-time supersampling steps, RUNTIME reads them from the render settings
+    /// @tparam Bounces Compile-time bounce count, RUNTIME reads it from the render settings
+    template <int Steps = RUNTIME, int Bounces = RUNTIME>
     static __m128 kernel_full(Camera *cam, int x, int y)
     {
         __m128 final_color = _mm_setzero_ps();
-        int steps = cam->renderSettings.supersampling_steps;
-        float step_width = 1.0f / steps;
+        const int steps = (Steps == RUNTIME) ? cam->renderSettings.supersampling_steps : Steps;
         float fx = static_cast<float>(x);
         float fy = static_cast<float>(y);
 
-        for (int i = 0; i < steps; i++)
+        FirstHit hit;
+        FirstHit *firstHit = cam->aovs.RecordsHits() ? &hit : nullptr;
+
+        // steps * steps low discrepancy positions inside the pixel instead of a regular grid
+        Sampler sampler(x, y);
+        for (int s = 0; s < steps * steps; s++)
         {
-            float subpixel_offset_x = fx + (i + 0.5f) * step_width;
-            for (int j = 0; j < steps; j++)
+            sampler.StartSample(s);
+            __m128 subpixel = sampler.Next();
+            LightRay ray = cam->GenerateRayFromPixel(fx + getX(subpixel), fy + getY(subpixel));
+            __m128 subpixel_color = cam->FullTrace<Bounces>(ray, cam->bounces, cam->scatterCount, cam->scatterRedux, cam->sceneMemory, sampler, 0.0f, firstHit);
+            final_color = _mm_add_ps(final_color, subpixel_color);
+            if (firstHit != nullptr)
             {
-                float subpixel_offset_y = fy + (j + 0.5f) * step_width;
-
-                LightRay subpixel_ray = cam->GenerateRayFromPixel(subpixel_offset_x, subpixel_offset_y);
-                __m128 subpixel_color = cam->FullTrace(subpixel_ray, cam->bounces, cam->scatterCount, cam->scatterRedux, cam->sceneMemory);
-
-                final_color = _mm_add_ps(final_color, subpixel_color);
+                cam->aovs.Add(y * cam->renderSettings.resolution[0] + x, hit);
             }
         }
 
         __m128 div = _mm_set1_ps(1.0f / (steps * steps));
         return _mm_mul_ps(final_color, div);
     }
+
+    /// @brief Traces a single ray through a random position inside the pixel, used by adaptive and progressive sampling
+    /// @param sampler Sampler of the pixel, set to the sample to trace
+    template <int Bounces = RUNTIME>
+    static __m128 kernel_sample(Camera *cam, int x, int y, Sampler &sampler)
+    {
+        __m128 subpixel = sampler.Next();
+        LightRay ray = cam->GenerateRayFromPixel(x + getX(subpixel), y + getY(subpixel));
+        if (!cam->aovs.RecordsHits())
+        {
+            return cam->FullTrace<Bounces>(ray, cam->bounces, cam->scatterCount, cam->scatterRedux, cam->sceneMemory, sampler);
+        }
+        FirstHit hit;
+        __m128 color = cam->FullTrace<Bounces>(ray, cam->bounces, cam->scatterCount, cam->scatterRedux, cam->sceneMemory, sampler, 0.0f, &hit);
+        cam->aovs.Add(y * cam->renderSettings.resolution[0] + x, hit);
+        return color;
+    }
+
+    /// @brief Renders with kernel_full. Common presets (see Templates/settings_*.xml) use a kernel
+    /// with compile-time supersampling steps and bounces, all other settings use the generic kernel.
+    /// Progressive and adaptive sampling use kernel_sample instead
+    void RenderFull()
+    {
+        struct KernelPreset
+        {
+            int steps;
+            int bounces;
+            void (Camera::*render)();
+        };
+
+        static const KernelPreset presets[] = {
+            {2, 2, &Camera::RenderImage<&Camera::SampleGrid<kernel_full<2, 2>>>}, // settings_testing
+            {2, 3, &Camera::RenderImage<&Camera::SampleGrid<kernel_full<2, 3>>>}, // settings_default
+            {3, 3, &Camera::RenderImage<&Camera::SampleGrid<kernel_full<3, 3>>>}, // settings_quality
+        };
+
+        if (renderSettings.progressive)
+        {
+            std::cout << "Using progressive sampling" << std::endl;
+            switch (bounces)
+            {
+            case 2:
+                RenderImage<&Camera::SampleProgressive<2>>();
+                break;
+            case 3:
+                RenderImage<&Camera::SampleProgressive<3>>();
+                break;
+            default:
+                RenderImage<&Camera::SampleProgressive<>>();
+                break;
+            }
+            return;
+        }
+
+        if (renderSettings.adaptive)
+        {
+            std::cout << "Using adaptive sampling" << std::endl;
+            switch (bounces)
+            {
+            case 2:
+                RenderImage<&Camera::SampleAdaptive<2>>();
+                break;
+            case 3:
+                RenderImage<&Camera::SampleAdaptive<3>>();
+                break;
+            default:
+                RenderImage<&Camera::SampleAdaptive<>>();
+                break;
+            }
+            return;
+        }
+
+        for (const KernelPreset &preset : presets)
+        {
+            if (preset.steps == renderSettings.supersampling_steps && preset.bounces == bounces)
+            {
+                std::cout << "Using precompiled kernel: " << preset.steps << " supersampling steps, " << preset.bounces << " bounces" << std::endl;
+                (this->*preset.render)();
+                return;
+            }
+        }
+
+        std::cout << "Using generic kernel" << std::endl;
+        RenderImage<&Camera::SampleGrid<kernel_full<>>>();
+    }
 };
\ No newline at end of file
@@ -0,0 +1,135 @@
+#pragma once
+#include <string>
+#include <iostream>
+
+#include <immintrin.h>
+
+/// @brief Instruction set levels the hot kernels are compiled for
+enum class IsaLevel
+{
+    SSE41 = 0,
+    AVX2 = 1,
+    AVX512 = 2,
+};
+
+/// @brief Hot render kernels of one ISA level
+struct KernelTable
+{
+    const char *name;
+    Collision (*memoryCollision)(const LightRay &ray, const BakedScene &scene, const float *&hitObject);
+    bool (*memoryOcclusion)(const LightRay &ray, const BakedScene &scene, float maxDistance);
+    __m128 (*specularScatter)(__m128 incoming, __m128 normal, float roughness, __m128 u);
+    void (*diffuseScatter)(__m128 normal, __m128 u1, __m128 u2, __m128 *directions);
+    void (*quantizeRow)(const __m128 *row, int count, int maxValue, int *out);
+};
+
+// One copy of the kernels per ISA level, each in its own namespace so the copies never get merged by the linker
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#define ISA_NAMESPACE isa_sse41
+#define ISA_LEVEL 0
+#define ISA_NAME "SSE4.1"
+#include "kernels.h"
+#undef ISA_NAMESPACE
+#undef ISA_LEVEL
+#undef ISA_NAME
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,bmi,bmi2")
+#define ISA_NAMESPACE isa_avx2
+#define ISA_LEVEL 1
+#define ISA_NAME "AVX2"
+#include "kernels.h"
+#undef ISA_NAMESPACE
+#undef ISA_LEVEL
+#undef ISA_NAME
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma,bmi,bmi2")
+#define ISA_NAMESPACE isa_avx512
+#define ISA_LEVEL 2
+#define ISA_NAME "AVX-512"
+#include "kernels.h"
+#undef ISA_NAMESPACE
+#undef ISA_LEVEL
+#undef ISA_NAME
+#pragma GCC pop_options
+
+/// @brief Kernels used by the renderer, set once at startup by SelectKernels
+inline KernelTable activeKernels = isa_sse41::kernels;
+
+/// @brief Highest ISA level supported by the CPU we are running on (CPUID)
+inline IsaLevel DetectIsaLevel()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq"))
+    {
+        return IsaLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2"))
+    {
+        return IsaLevel::AVX2;
+    }
+    return IsaLevel::SSE41;
+}
+
+/// @brief Parses the value of the --isa flag
+/// @param name sse4.1, avx2 or avx512
+/// @param level Parsed level
+/// @return false if the name is unknown
+inline bool ParseIsaLevel(const std::string &name, IsaLevel &level)
+{
+    if (name == "sse4.1" || name == "sse41")
+    {
+        level = IsaLevel::SSE41;
+    }
+    else if (name == "avx2")
+    {
+        level = IsaLevel::AVX2;
+    }
+    else if (name == "avx512")
+    {
+        level = IsaLevel::AVX512;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/// @brief Selects the kernels for the best ISA level of this CPU
+/// @param forced Level requested with --isa, nullptr for automatic selection. Falls back to the detected level if the CPU does not support it
+inline void SelectKernels(const IsaLevel *forced)
+{
+    IsaLevel detected = DetectIsaLevel();
+    IsaLevel level = detected;
+    if (forced != nullptr)
+    {
+        if (*forced > detected)
+        {
+            std::cerr << "DISPATCH ERROR: REQUESTED ISA LEVEL NOT SUPPORTED BY THIS CPU, USING DETECTED LEVEL" << std::endl;
+        }
+        else
+        {
+            level = *forced;
+        }
+    }
+
+    switch (level)
+    {
+    case IsaLevel::AVX512:
+        activeKernels = isa_avx512::kernels;
+        break;
+    case IsaLevel::AVX2:
+        activeKernels = isa_avx2::kernels;
+        break;
+    default:
+        activeKernels = isa_sse41::kernels;
+        break;
+    }
+
+    std::cout << "Using " << activeKernels.name << " kernels" << (forced != nullptr ? " (forced)" : "") << std::endl;
+}
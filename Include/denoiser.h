@@ -0,0 +1,154 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <omp.h>
+
+#include <immintrin.h>
+
+#include "m128Utils.h"
+#include "alignedmemory.h"
+
+using namespace m128Calc;
+
+/// @brief Pixels per tile side, one tile is the unit of work of a thread
+const int DENOISE_TILE_SIZE = 16;
+
+/// @brief Feature buffers of the first hits per pixel, row major. They guide the denoiser: pixels only share light with neighbours
+/// that show the same surface
+struct DenoiseFeatures
+{
+    /// @brief Mean normal of the first hits, 0 for the background
+    __m128 *normal = nullptr;
+    /// @brief Mean color of the first hits, 1 for the background and emissive objects
+    __m128 *albedo = nullptr;
+    /// @brief Distance to the closest first hit, NO_HIT_DISTANCE for the background
+    float *depth = nullptr;
+};
+
+/// @brief Edge avoiding a-trous wavelet filter (Dammertz et al. 2010). Every iteration applies a 5x5 B3 spline kernel whose taps
+/// are spread 2^i pixels apart, so 5 iterations cover 125x125 pixels with 25 taps each. Each tap is weighted down by
+/// the differences of color, normal and depth to the center pixel, which keeps edges sharp.
+/// The color is divided by the albedo before filtering and multiplied back after, textures and object colors are not blurred
+/// @param image Row major linear colors, overwritten with the denoised colors
+/// @param features Feature buffers of the same size
+/// @param iterations Filter iterations, the kernel width doubles with each
+/// @param sigmaColor Color difference that reduces a tap to 1/e, halves with every iteration
+/// @param sigmaNormal Normal difference (length of the difference vector) that reduces a tap to 1/e
+/// @param sigmaDepth Relative depth difference per pixel of tap distance that reduces a tap to 1/e
+inline void denoise_atrous(__m128 *image, const DenoiseFeatures &features, int width, int height,
+                           int iterations, float sigmaColor, float sigmaNormal, float sigmaDepth)
+{
+    const int pixelCount = width * height;
+    __m128 *buffers[2] = {(__m128 *)allocate_aligned(16, pixelCount * sizeof(__m128)), (__m128 *)allocate_aligned(16, pixelCount * sizeof(__m128))};
+    if (buffers[0] == nullptr || buffers[1] == nullptr)
+    {
+        std::cerr << "RENDER ERROR: NOT ENOUGH MEMORY TO DENOISE, KEEPING THE NOISY IMAGE" << std::endl;
+        free_aligned(buffers[0]);
+        free_aligned(buffers[1]);
+        return;
+    }
+
+    // Demodulate: divide by the albedo, channels with (almost) no albedo have no light to filter
+    const __m128 minAlbedo = _mm_set1_ps(1e-3f);
+#pragma omp parallel for
+    for (int p = 0; p < pixelCount; p++)
+    {
+        __m128 albedo = features.albedo[p];
+        __m128 valid = _mm_cmpgt_ps(albedo, minAlbedo);
+        buffers[0][p] = _mm_and_ps(_mm_div_ps(image[p], _mm_max_ps(albedo, minAlbedo)), valid);
+    }
+
+    const float spline[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+    const int tilesX = (width + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+    const int tilesY = (height + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+    const float invNormal = 1.0f / (sigmaNormal * sigmaNormal);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        const __m128 *source = buffers[i & 1];
+        __m128 *target = buffers[(i + 1) & 1];
+        const int step = 1 << i;
+        const float sigmaC = sigmaColor / step;
+        const float invColor = 1.0f / (sigmaC * sigmaC);
+        const float invDepth = 1.0f / (sigmaDepth * step);
+
+#pragma omp parallel for collapse(2) schedule(dynamic)
+        for (int ty = 0; ty < tilesY; ty++)
+        {
+            for (int tx = 0; tx < tilesX; tx++)
+            {
+                // 25 taps, padded to a multiple of 4 for the vectorized weights
+                alignas(16) float exponents[28];
+                alignas(16) float kernel[28];
+                alignas(16) float weights[28];
+                int taps[28];
+
+                const int yEnd = std::min((ty + 1) * DENOISE_TILE_SIZE, height);
+                const int xEnd = std::min((tx + 1) * DENOISE_TILE_SIZE, width);
+                for (int y = ty * DENOISE_TILE_SIZE; y < yEnd; y++)
+                {
+                    for (int x = tx * DENOISE_TILE_SIZE; x < xEnd; x++)
+                    {
+                        const int p = y * width + x;
+                        const __m128 color = source[p];
+                        const __m128 normal = features.normal[p];
+                        const float depth = features.depth[p];
+
+                        // Edge stopping exponents of all taps, taps outside the image get no weight
+                        for (int k = 0; k < 28; k++)
+                        {
+                            int ky = k / 5 - 2;
+                            int kx = k % 5 - 2;
+                            int qx = x + kx * step;
+                            int qy = y + ky * step;
+                            if (k >= 25 || qx < 0 || qx >= width || qy < 0 || qy >= height)
+                            {
+                                taps[k] = p;
+                                kernel[k] = 0.0f;
+                                exponents[k] = 0.0f;
+                                continue;
+                            }
+                            int q = qy * width + qx;
+                            __m128 colorDiff = _mm_sub_ps(source[q], color);
+                            __m128 normalDiff = _mm_sub_ps(features.normal[q], normal);
+                            float depthDiff = std::abs(features.depth[q] - depth) / std::max(std::min(features.depth[q], depth), 1e-6f);
+                            taps[k] = q;
+                            kernel[k] = spline[kx + 2] * spline[ky + 2];
+                            exponents[k] = -(_mm_cvtss_f32(_mm_dp_ps(colorDiff, colorDiff, 0x71)) * invColor +
+                                             _mm_cvtss_f32(_mm_dp_ps(normalDiff, normalDiff, 0x71)) * invNormal +
+                                             depthDiff * invDepth);
+                        }
+                        for (int k = 0; k < 28; k += 4)
+                        {
+                            _mm_store_ps(weights + k, _mm_mul_ps(_mm_load_ps(kernel + k), exp4(_mm_load_ps(exponents + k))));
+                        }
+
+                        __m128 sum = _mm_setzero_ps();
+                        float weightSum = 0.0f;
+                        for (int k = 0; k < 25; k++)
+                        {
+                            sum = fmadd(source[taps[k]], _mm_set1_ps(weights[k]), sum);
+                            weightSum += weights[k];
+                        }
+                        // The center tap always has full weight, the sum is never 0
+                        target[p] = _mm_mul_ps(sum, _mm_set1_ps(1.0f / weightSum));
+                    }
+                }
+            }
+        }
+    }
+
+    // Remodulate with the albedo
+    const __m128 *result = buffers[iterations & 1];
+#pragma omp parallel for
+    for (int p = 0; p < pixelCount; p++)
+    {
+        __m128 albedo = features.albedo[p];
+        __m128 valid = _mm_cmpgt_ps(albedo, minAlbedo);
+        image[p] = _mm_blendv_ps(image[p], _mm_mul_ps(result[p], albedo), valid);
+    }
+
+    free_aligned(buffers[0]);
+    free_aligned(buffers[1]);
+}
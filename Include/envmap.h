@@ -0,0 +1,363 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <immintrin.h>
+
+using namespace std;
+using namespace m128Calc;
+
+/// @brief Texels per tile side of the environment map storage
+const int ENVMAP_TILE_SIZE = 8;
+/// @brief Largest supported map, 16K x 8K. Keeps the texel indices and buffer sizes inside int
+const long long ENVMAP_MAX_TEXELS = 16384LL * 8192LL;
+
+/// @brief A direction sampled from the environment map
+struct EnvironmentSample
+{
+    /// @brief Normalized direction towards the environment
+    __m128 direction;
+    /// @brief Radiance coming from the direction
+    __m128 radiance;
+    /// @brief Probability density of the direction, per solid angle
+    float pdf;
+};
+
+/// @brief Equirectangular HDR environment map (.pfm or .hdr), used as background and light source.
+/// Texels are stored in 8x8 tiles, so neighbouring directions share cache lines.
+/// A 2D CDF over the texel luminance allows importance sampling of bright regions
+class EnvironmentMap
+{
+private:
+    int width = 0;
+    int height = 0;
+    int tilesX = 0;
+    /// @brief Tiled texels, RGB + padding
+    __m128 *texels = nullptr;
+
+    /// @brief Per row CDF over the columns, (width + 1) entries per row
+    std::vector<float> conditionalCdf;
+    /// @brief CDF over the rows, height + 1 entries
+    std::vector<float> marginalCdf;
+    /// @brief Sum of all sampling weights, 0 if the map is black
+    float weightSum = 0;
+
+    /// @brief Position of a texel in the tiled storage
+    inline int TexelIndex(int x, int y) const
+    {
+        int tile = (y / ENVMAP_TILE_SIZE) * tilesX + x / ENVMAP_TILE_SIZE;
+        return tile * ENVMAP_TILE_SIZE * ENVMAP_TILE_SIZE + (y % ENVMAP_TILE_SIZE) * ENVMAP_TILE_SIZE + x % ENVMAP_TILE_SIZE;
+    }
+
+    /// @brief Checks the header that was just parsed, before anything is allocated from its dimensions
+    /// @param texelBytes Smallest size of a texel in the file
+    /// @param rowBytes Smallest size of the extra data per row in the file
+    bool ValidHeader(std::ifstream &file, int texelBytes, int rowBytes)
+    {
+        if (!file || width <= 0 || height <= 0 || (long long)width * height > ENVMAP_MAX_TEXELS)
+        {
+            std::cerr << "ENVIRONMENT ERROR: INVALID HEADER" << std::endl;
+            return false;
+        }
+        const std::streampos dataStart = file.tellg();
+        file.seekg(0, std::ios::end);
+        const std::streamoff dataBytes = file.tellg() - dataStart;
+        file.seekg(dataStart);
+        if (!file || dataBytes < ((long long)width * texelBytes + rowBytes) * height)
+        {
+            std::cerr << "ENVIRONMENT ERROR: FILE TOO SHORT FOR " << width << "x" << height << " TEXELS" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /// @brief Reads a Portable Float Map. Rows are stored bottom to top
+    bool LoadPFM(std::ifstream &file, std::vector<float> &rgb)
+    {
+        std::string magic;
+        float scale;
+        file >> magic >> width >> height >> scale;
+        file.get(); // Single whitespace before the data
+        if (magic != "PF")
+        {
+            std::cerr << "ENVIRONMENT ERROR: ONLY RGB PFM FILES ARE SUPPORTED" << std::endl;
+            return false;
+        }
+        if (!ValidHeader(file, 3 * sizeof(float), 0))
+        {
+            return false;
+        }
+        bool bigEndian = scale > 0;
+
+        rgb.resize((size_t)width * height * 3);
+        for (int y = height - 1; y >= 0; y--)
+        {
+            file.read((char *)(rgb.data() + y * width * 3), width * 3 * sizeof(float));
+        }
+        if (bigEndian)
+        {
+            for (float &value : rgb)
+            {
+                uint32_t bits;
+                std::memcpy(&bits, &value, 4);
+                bits = __builtin_bswap32(bits);
+                std::memcpy(&value, &bits, 4);
+            }
+        }
+        return (bool)file;
+    }
+
+    /// @brief Reads a Radiance RGBE file, flat or run length encoded scanlines
+    bool LoadHDR(std::ifstream &file, std::vector<float> &rgb)
+    {
+        std::string line;
+        while (std::getline(file, line) && !line.empty())
+        {
+            if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+            {
+                std::cerr << "ENVIRONMENT ERROR: UNSUPPORTED HDR FORMAT " << line << std::endl;
+                return false;
+            }
+        }
+        std::string yAxis, xAxis;
+        file >> yAxis >> height >> xAxis >> width;
+        file.get();
+        if (yAxis != "-Y" || xAxis != "+X")
+        {
+            std::cerr << "ENVIRONMENT ERROR: ONLY -Y +X HDR ORIENTATION IS SUPPORTED" << std::endl;
+            return false;
+        }
+        // Run length encoding packs runs of a channel into 2 bytes, only the 4 bytes starting every scanline are certain
+        if (!ValidHeader(file, 0, 4))
+        {
+            return false;
+        }
+
+        rgb.resize((size_t)width * height * 3);
+        std::vector<uint8_t> scanline(width * 4);
+        for (int y = 0; y < height; y++)
+        {
+            uint8_t start[4];
+            file.read((char *)start, 4);
+            if (start[0] == 2 && start[1] == 2 && ((start[2] << 8) | start[3]) == width)
+            {
+                // Run length encoded, each channel separately
+                for (int c = 0; c < 4; c++)
+                {
+                    int x = 0;
+                    while (x < width && file)
+                    {
+                        int count = file.get();
+                        if (count > 128)
+                        {
+                            count -= 128;
+                            uint8_t value = file.get();
+                            for (int i = 0; i < count && x < width; i++, x++)
+                            {
+                                scanline[x * 4 + c] = value;
+                            }
+                        }
+                        else
+                        {
+                            for (int i = 0; i < count && x < width; i++, x++)
+                            {
+                                scanline[x * 4 + c] = file.get();
+                            }
+                        }
+                    }
+                }
+            }
+            else
+            {
+                // Flat RGBE
+                std::memcpy(scanline.data(), start, 4);
+                file.read((char *)scanline.data() + 4, (width - 1) * 4);
+            }
+
+            for (int x = 0; x < width; x++)
+            {
+                uint8_t *rgbe = scanline.data() + x * 4;
+                float f = rgbe[3] == 0 ? 0.0f : std::ldexp(1.0f, rgbe[3] - (128 + 8));
+                rgb[(y * width + x) * 3] = rgbe[0] * f;
+                rgb[(y * width + x) * 3 + 1] = rgbe[1] * f;
+                rgb[(y * width + x) * 3 + 2] = rgbe[2] * f;
+            }
+        }
+        return (bool)file;
+    }
+
+    /// @brief Builds the sampling distribution. Weight of a texel is its luminance times sin(theta),
+    /// as rows near the poles cover less solid angle
+    void BuildDistribution()
+    {
+        conditionalCdf.assign(height * (width + 1), 0.0f);
+        marginalCdf.assign(height + 1, 0.0f);
+
+        for (int y = 0; y < height; y++)
+        {
+            float sinTheta = std::sin(3.1415926535f * (y + 0.5f) / height);
+            float *rowCdf = conditionalCdf.data() + y * (width + 1);
+            for (int x = 0; x < width; x++)
+            {
+                __m128 texel = texels[TexelIndex(x, y)];
+                rowCdf[x + 1] = rowCdf[x] + luminance(texel) * sinTheta;
+            }
+            marginalCdf[y + 1] = marginalCdf[y] + rowCdf[width];
+        }
+        weightSum = marginalCdf[height];
+    }
+
+    /// @brief Texel of the equirectangular map in a direction
+    inline void TexelAt(__m128 direction, int &x, int &y) const
+    {
+        float u = 0.5f + std::atan2(getX(direction), -getZ(direction)) * (0.5f / 3.1415926535f);
+        float v = std::acos(std::min(std::max(getY(direction), -1.0f), 1.0f)) * (1.0f / 3.1415926535f);
+        x = std::max(std::min((int)(u * width), width - 1), 0);
+        y = std::max(std::min((int)(v * height), height - 1), 0);
+    }
+
+    /// @brief Finds the interval of a CDF containing u, u is in [0, total)
+    static int SampleCdf(const float *cdf, int count, float u)
+    {
+        const float *upper = std::upper_bound(cdf + 1, cdf + count + 1, u);
+        return std::min((int)(upper - cdf) - 1, count - 1);
+    }
+
+public:
+    /// @brief Loads an equirectangular environment map
+    /// @param path .pfm or .hdr file
+    /// @param intensity Multiplier for the radiance
+    EnvironmentMap(const std::string &path, float intensity)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cerr << "ENVIRONMENT ERROR: UNABLE TO OPEN " << path << std::endl;
+            return;
+        }
+
+        std::vector<float> rgb;
+        std::string extension = path.substr(path.find_last_of('.') + 1);
+        bool loaded = false;
+        if (extension == "pfm")
+        {
+            loaded = LoadPFM(file, rgb);
+        }
+        else if (extension == "hdr")
+        {
+            loaded = LoadHDR(file, rgb);
+        }
+        else
+        {
+            std::cerr << "ENVIRONMENT ERROR: UNKNOWN FILE TYPE " << extension << std::endl;
+        }
+        if (!loaded || width <= 0 || height <= 0)
+        {
+            std::cerr << "ENVIRONMENT ERROR: UNABLE TO READ " << path << std::endl;
+            width = 0;
+            height = 0;
+            return;
+        }
+
+        // Copy into tiles, partial tiles at the border are padded
+        tilesX = (width + ENVMAP_TILE_SIZE - 1) / ENVMAP_TILE_SIZE;
+        int tilesY = (height + ENVMAP_TILE_SIZE - 1) / ENVMAP_TILE_SIZE;
+        texels = (__m128 *)allocate_aligned(16, (size_t)tilesX * tilesY * ENVMAP_TILE_SIZE * ENVMAP_TILE_SIZE * sizeof(__m128));
+        if (texels == nullptr)
+        {
+            std::cerr << "ENVIRONMENT ERROR: NOT ENOUGH MEMORY FOR " << path << std::endl;
+            width = 0;
+            height = 0;
+            return;
+        }
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                const float *c = rgb.data() + (y * width + x) * 3;
+                texels[TexelIndex(x, y)] = _mm_mul_ps(_mm_setr_ps(c[0], c[1], c[2], 0), _mm_set1_ps(intensity));
+            }
+        }
+
+        BuildDistribution();
+        std::cout << "Loaded environment map " << path << " (" << width << "x" << height << ")" << std::endl;
+    }
+
+    ~EnvironmentMap()
+    {
+        if (texels != nullptr)
+        {
+            free_aligned(texels);
+        }
+    }
+
+    EnvironmentMap(const EnvironmentMap &) = delete;
+    EnvironmentMap &operator=(const EnvironmentMap &) = delete;
+
+    /// @brief False if the map could not be loaded
+    bool Valid() const { return width > 0; }
+
+    /// @brief True if the map has light that can be importance sampled
+    bool CanSample() const { return weightSum > 0; }
+
+    /// @brief Radiance coming from a direction
+    /// @param direction Normalized direction, y is up
+    inline __m128 Lookup(__m128 direction) const
+    {
+        int x, y;
+        TexelAt(direction, x, y);
+        return texels[TexelIndex(x, y)];
+    }
+
+    /// @brief Density of Sample producing the direction, per solid angle
+    /// @param direction Normalized direction, y is up
+    inline float Pdf(__m128 direction) const
+    {
+        int x, y;
+        TexelAt(direction, x, y);
+        const float *rowCdf = conditionalCdf.data() + y * (width + 1);
+        float texelWeight = rowCdf[x + 1] - rowCdf[x];
+        // From x and z instead of 1 - y^2, which cancels out near the poles
+        float sinTheta = std::sqrt(getX(direction) * getX(direction) + getZ(direction) * getZ(direction));
+        float pdfUV = texelWeight * width * height / weightSum;
+        return sinTheta > 1e-6f ? pdfUV / (2.0f * 3.1415926535f * 3.1415926535f * sinTheta) : 0.0f;
+    }
+
+    /// @brief Samples a direction proportional to the radiance of the map
+    /// @param u1 Uniform random number in [0, 1)
+    /// @param u2 Uniform random number in [0, 1)
+    inline EnvironmentSample Sample(float u1, float u2) const
+    {
+        // Row from the marginal, column from the conditional distribution of that row
+        int y = SampleCdf(marginalCdf.data(), height, u1 * weightSum);
+        const float *rowCdf = conditionalCdf.data() + y * (width + 1);
+        float rowSum = rowCdf[width];
+        int x = SampleCdf(rowCdf, width, u2 * rowSum);
+
+        // Continuous position inside the texel
+        float rowWeight = marginalCdf[y + 1] - marginalCdf[y];
+        float texelWeight = rowCdf[x + 1] - rowCdf[x];
+        float dv = rowWeight > 0 ? (u1 * weightSum - marginalCdf[y]) / rowWeight : 0.5f;
+        float du = texelWeight > 0 ? (u2 * rowSum - rowCdf[x]) / texelWeight : 0.5f;
+        float u = (x + std::min(std::max(du, 0.0f), 1.0f)) / width;
+        float v = (y + std::min(std::max(dv, 0.0f), 1.0f)) / height;
+
+        float theta = v * 3.1415926535f;
+        float phi = (u - 0.5f) * 2.0f * 3.1415926535f;
+        float sinTheta = std::sin(theta);
+
+        EnvironmentSample sample;
+        sample.direction = _mm_setr_ps(sinTheta * std::sin(phi), std::cos(theta), -sinTheta * std::cos(phi), 0);
+        sample.radiance = texels[TexelIndex(x, y)];
+
+        // Density over the unit square is weight / mean weight, converted to solid angle
+        float pdfUV = texelWeight * width * height / weightSum;
+        sample.pdf = sinTheta > 1e-6f ? pdfUV / (2.0f * 3.1415926535f * 3.1415926535f * sinTheta) : 0.0f;
+        return sample;
+    }
+};
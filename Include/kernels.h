@@ -0,0 +1,498 @@
+// Hot render kernels: intersection, shading and quantization.
+// No include guard on purpose: cpudispatch.h includes this file once per ISA level,
+// each time inside its own namespace (ISA_NAMESPACE) and compiled for its own target (ISA_LEVEL).
+
+namespace ISA_NAMESPACE
+{
+    /// @brief Distance along the ray to a baked sphere
+    /// @return Distance, NO_HIT_DISTANCE if the sphere is missed
+    inline float SphereDistance(const LightRay &ray, const float *objectMemStart)
+    {
+        __m128 position = _mm_load_ps(objectMemStart);
+        float radius = objectMemStart[4];
+
+        __m128 L = _mm_sub_ps(position, ray.origin);
+        float tca = dot(L, ray.direction);
+        float d2 = dot(L, L) - tca * tca;
+        float radius2 = radius * radius;
+
+        // Clamped so a miss does not produce NaN, the result is masked out below
+        float thc = sqrtf(std::max(radius2 - d2, 0.0f));
+        float t0 = tca - thc;
+        float t1 = tca + thc;
+
+        // Ray starts inside the sphere: use the far intersection
+        float t = (t0 < 0) ? t1 : t0;
+
+        bool hit = (d2 <= radius2) & (t > 0.001f);
+        return hit ? t : NO_HIT_DISTANCE;
+    }
+
+    /// @brief Distance along the ray to a baked plane
+    /// @return Distance, NO_HIT_DISTANCE if the plane is missed
+    inline float PlaneDistance(const LightRay &ray, const float *objectMemStart)
+    {
+        __m128 position = _mm_load_ps(objectMemStart);
+        __m128 normal = _mm_load_ps(objectMemStart + 8);
+        __m128 localX = _mm_load_ps(objectMemStart + 12);
+        __m128 localY = _mm_load_ps(objectMemStart + 16);
+
+        float divider = dot(ray.direction, normal);
+        bool facing = abs(divider) > 0.001f;
+        // Keep the division finite for parallel rays, the result is masked out below
+        divider = facing ? divider : 1.0f;
+
+        float dist = dot(_mm_sub_ps(position, ray.origin), normal) / divider;
+
+        __m128 distv = _mm_set_ps1(dist);
+        __m128 point = fmadd(ray.direction, distv, ray.origin);
+        __m128 diff = _mm_sub_ps(point, position);
+
+        // Compare squared distances, saves both square roots
+        float y_dist2 = norm2(cross(diff, localX));
+        float x_dist2 = norm2(cross(diff, localY));
+        float scaleX = objectMemStart[4];
+        float scaleY = objectMemStart[5];
+
+        bool hit = facing & (dist > 0.001f) & (y_dist2 <= scaleY * scaleY) & (x_dist2 <= scaleX * scaleX);
+        return hit ? dist : NO_HIT_DISTANCE;
+    }
+
+    /// @brief Runs one type specialized loop over a contiguous range of baked objects
+    /// @tparam Distance Distance function for the object type of the range
+    /// @param closestDistance Closest distance so far, updated in place
+    /// @param closestObject Closest object so far, updated in place
+    template <float (*Distance)(const LightRay &, const float *)>
+    inline void ClosestInRange(const LightRay &ray, const float *rangeStart, size_t count, float &closestDistance, const float *&closestObject)
+    {
+        PROFILE_ADD(intersectionTests, count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const float *objOffset = rangeStart + 28 * i;
+            float dist = Distance(ray, objOffset);
+
+            // Branchless select, compiles to conditional moves
+            bool closer = dist < closestDistance;
+            closestDistance = closer ? dist : closestDistance;
+            closestObject = closer ? objOffset : closestObject;
+        }
+    }
+
+    /// @brief Runs one type specialized loop over a contiguous range of baked objects, stops at the first hit
+    /// @tparam Distance Distance function for the object type of the range
+    /// @return true if any object is hit closer than maxDistance
+    template <float (*Distance)(const LightRay &, const float *)>
+    inline bool AnyInRange(const LightRay &ray, const float *rangeStart, size_t count, float maxDistance)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (Distance(ray, rangeStart + 28 * i) < maxDistance)
+            {
+                PROFILE_ADD(intersectionTests, i + 1);
+                return true;
+            }
+        }
+        PROFILE_ADD(intersectionTests, count);
+        return false;
+    }
+
+    /// @brief Ray data for the box tests of the BVH traversal
+    struct BvhRay
+    {
+        __m128 origin;
+        __m128 inverseDirection;
+        /// @brief Axes the ray runs parallel to (direction 0), all bits set in their lanes
+        __m128 parallel;
+        bool anyParallel;
+
+        inline explicit BvhRay(const LightRay &ray) : origin(ray.origin)
+        {
+            // -Ofast assumes finite math, a zero direction must not reach the division. Parallel axes are handled in NodeDistance
+            const __m128 tiny = _mm_set1_ps(1e-20f);
+            parallel = _mm_blend_ps(_mm_cmplt_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), ray.direction), tiny), _mm_setzero_ps(), 0b1000);
+            anyParallel = _mm_movemask_ps(parallel) != 0;
+            inverseDirection = _mm_div_ps(_mm_set1_ps(1.0f), _mm_blendv_ps(ray.direction, tiny, parallel));
+        }
+    };
+
+    /// @brief Slab test of a BVH node
+    /// @return Distance to the entry of the box, 0 inside, NO_HIT_DISTANCE if missed or not closer than maxDistance
+    inline float NodeDistance(const BvhRay &ray, const BvhNode &node, float maxDistance)
+    {
+        // The fourth lane holds first and count, it is replaced before the reduction
+        const __m128 lower = _mm_loadu_ps(node.min);
+        const __m128 upper = _mm_loadu_ps(node.max);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(lower, ray.origin), ray.inverseDirection);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(upper, ray.origin), ray.inverseDirection);
+        __m128 tNear = _mm_min_ps(t0, t1);
+        __m128 tFar = _mm_max_ps(t0, t1);
+        if (ray.anyParallel)
+        {
+            // A parallel axis does not limit the distance, but the origin has to lie between its faces (on a face counts)
+            __m128 inside = _mm_and_ps(_mm_cmple_ps(lower, ray.origin), _mm_cmple_ps(ray.origin, upper));
+            __m128 parallelNear = _mm_blendv_ps(_mm_set1_ps(NO_HIT_DISTANCE), _mm_set1_ps(-NO_HIT_DISTANCE), inside);
+            tNear = _mm_blendv_ps(tNear, parallelNear, ray.parallel);
+            tFar = _mm_blendv_ps(tFar, _mm_set1_ps(NO_HIT_DISTANCE), ray.parallel);
+        }
+        tNear = _mm_blend_ps(tNear, _mm_setzero_ps(), 0b1000);
+        tFar = _mm_blend_ps(tFar, _mm_set1_ps(maxDistance), 0b1000);
+        tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+        tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+        tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+        tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+        float entry = _mm_cvtss_f32(tNear);
+        return entry <= _mm_cvtss_f32(tFar) ? entry : NO_HIT_DISTANCE;
+    }
+
+    /// @brief Walks the sphere BVH front to back and calls the leaf function for every leaf the ray enters
+    /// @param maxDistance Boxes further away are skipped. Read again after every leaf, so a closer hit prunes the rest
+    /// @param leaf bool(uint32_t firstBlock, uint32_t blockCount), returns true to stop the traversal
+    /// @return true if a leaf function stopped the traversal
+    template <typename Leaf>
+    inline bool TraverseSphereBvh(const LightRay &ray, const BakedScene &scene, const float &maxDistance, Leaf &&leaf)
+    {
+        if (scene.bvhNodeCount == 0)
+        {
+            return false;
+        }
+        if (scene.bvhNodes[0].count != 0)
+        {
+            // Few spheres, the root is the only leaf: testing its box would only add work
+            return leaf(scene.bvhNodes[0].first, scene.bvhNodes[0].count);
+        }
+        const BvhRay bvhRay(ray);
+        struct Entry
+        {
+            uint32_t node;
+            float distance;
+        };
+        Entry stack[BVH_MAX_DEPTH + 1];
+        int top = 0;
+        float distance = NodeDistance(bvhRay, scene.bvhNodes[0], maxDistance);
+        if (distance == NO_HIT_DISTANCE)
+        {
+            return false;
+        }
+        stack[top++] = {0, distance};
+
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            if (entry.distance >= maxDistance)
+            {
+                continue;
+            }
+            const BvhNode *node = scene.bvhNodes + entry.node;
+            while (node->count == 0)
+            {
+                const uint32_t left = node->first;
+                float leftDistance = NodeDistance(bvhRay, scene.bvhNodes[left], maxDistance);
+                float rightDistance = NodeDistance(bvhRay, scene.bvhNodes[left + 1], maxDistance);
+                PROFILE_ADD(intersectionTests, 2);
+                if (leftDistance == NO_HIT_DISTANCE && rightDistance == NO_HIT_DISTANCE)
+                {
+                    node = nullptr;
+                    break;
+                }
+                // Nearer child first, the other one waits on the stack
+                uint32_t near = leftDistance <= rightDistance ? left : left + 1;
+                float farDistance = leftDistance <= rightDistance ? rightDistance : leftDistance;
+                if (farDistance != NO_HIT_DISTANCE)
+                {
+                    stack[top++] = {near == left ? left + 1 : left, farDistance};
+                }
+                node = scene.bvhNodes + near;
+            }
+            if (node != nullptr && leaf(node->first, node->count))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// @brief Closest hit of the ray with the baked spheres, one sphere of a BVH leaf at a time
+    /// @param closestDistance Closest distance so far, updated in place
+    /// @param closestObject Closest object so far, updated in place
+    inline void ClosestSphere(const LightRay &ray, const BakedScene &scene, float &closestDistance, const float *&closestObject)
+    {
+        TraverseSphereBvh(ray, scene, closestDistance, [&](uint32_t firstBlock, uint32_t blockCount)
+                          {
+            PROFILE_ADD(intersectionTests, 8 * blockCount);
+            for (uint32_t lane = 8 * firstBlock; lane < 8 * (firstBlock + blockCount); lane++)
+            {
+                const uint32_t sphereIndex = scene.sphereOrder[lane];
+                if (sphereIndex == BVH_PADDING)
+                {
+                    break;
+                }
+                const float *sphere = scene.spheres + 28 * (size_t)sphereIndex;
+                float dist = SphereDistance(ray, sphere);
+                bool closer = dist < closestDistance;
+                closestDistance = closer ? dist : closestDistance;
+                closestObject = closer ? sphere : closestObject;
+            }
+            return false; });
+    }
+
+    /// @brief Is any baked sphere hit closer than maxDistance, stops at the first hit
+    inline bool AnySphere(const LightRay &ray, const BakedScene &scene, float maxDistance)
+    {
+        return TraverseSphereBvh(ray, scene, maxDistance, [&](uint32_t firstBlock, uint32_t blockCount)
+                                 {
+            for (uint32_t lane = 8 * firstBlock; lane < 8 * (firstBlock + blockCount); lane++)
+            {
+                const uint32_t sphereIndex = scene.sphereOrder[lane];
+                if (sphereIndex == BVH_PADDING)
+                {
+                    break;
+                }
+                if (SphereDistance(ray, scene.spheres + 28 * (size_t)sphereIndex) < maxDistance)
+                {
+                    PROFILE_ADD(intersectionTests, lane - 8 * firstBlock + 1);
+                    return true;
+                }
+            }
+            PROFILE_ADD(intersectionTests, 8 * blockCount);
+            return false; });
+    }
+
+#if ISA_LEVEL >= 1
+    /// @brief Ray origin and direction broadcast into 8 lanes
+    struct RayLanes8
+    {
+        __m256 ox, oy, oz;
+        __m256 dx, dy, dz;
+
+        inline explicit RayLanes8(const LightRay &ray)
+        {
+            alignas(16) float origin[4];
+            alignas(16) float direction[4];
+            _mm_store_ps(origin, ray.origin);
+            _mm_store_ps(direction, ray.direction);
+            ox = _mm256_set1_ps(origin[0]);
+            oy = _mm256_set1_ps(origin[1]);
+            oz = _mm256_set1_ps(origin[2]);
+            dx = _mm256_set1_ps(direction[0]);
+            dy = _mm256_set1_ps(direction[1]);
+            dz = _mm256_set1_ps(direction[2]);
+        }
+    };
+
+    /// @brief Distances to the 8 spheres of a block
+    /// @param hit Set to the lanes whose sphere is hit in front of the ray
+    inline __m256 SphereBlockDistance(const RayLanes8 &ray, const float *block, __m256 &hit)
+    {
+        const __m256 minDistance = _mm256_set1_ps(0.001f);
+        const __m256 zero = _mm256_setzero_ps();
+
+        __m256 Lx = _mm256_sub_ps(_mm256_load_ps(block), ray.ox);
+        __m256 Ly = _mm256_sub_ps(_mm256_load_ps(block + 8), ray.oy);
+        __m256 Lz = _mm256_sub_ps(_mm256_load_ps(block + 16), ray.oz);
+        __m256 radius2 = _mm256_load_ps(block + 24);
+
+        __m256 tca = _mm256_fmadd_ps(Lx, ray.dx, _mm256_fmadd_ps(Ly, ray.dy, _mm256_mul_ps(Lz, ray.dz)));
+        __m256 L2 = _mm256_fmadd_ps(Lx, Lx, _mm256_fmadd_ps(Ly, Ly, _mm256_mul_ps(Lz, Lz)));
+        __m256 d2 = _mm256_fnmadd_ps(tca, tca, L2);
+
+        __m256 thc = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(radius2, d2), zero));
+        __m256 t0 = _mm256_sub_ps(tca, thc);
+        __m256 t1 = _mm256_add_ps(tca, thc);
+
+        // Ray starts inside the sphere: use the far intersection
+        __m256 t = _mm256_blendv_ps(t0, t1, _mm256_cmp_ps(t0, zero, _CMP_LT_OQ));
+
+        hit = _mm256_and_ps(_mm256_cmp_ps(d2, radius2, _CMP_LE_OQ), _mm256_cmp_ps(t, minDistance, _CMP_GT_OQ));
+        return t;
+    }
+
+    /// @brief Closest hit of the ray with the baked spheres, the spheres of a BVH leaf 8 at a time.
+    /// Lanes that hit closer than the current closest are compacted with a movemask, usually none are
+    /// @param closestDistance Closest distance so far, updated in place
+    /// @param closestObject Closest object so far, updated in place
+    inline void ClosestSphere8(const LightRay &ray, const BakedScene &scene, float &closestDistance, const float *&closestObject)
+    {
+        const RayLanes8 lanes(ray);
+        TraverseSphereBvh(ray, scene, closestDistance, [&](uint32_t firstBlock, uint32_t blockCount)
+                          {
+            PROFILE_ADD(intersectionTests, 8 * blockCount);
+            __m256 closest = _mm256_set1_ps(closestDistance);
+            for (size_t b = firstBlock; b < firstBlock + blockCount; b++)
+            {
+                __m256 hit;
+                __m256 t = SphereBlockDistance(lanes, scene.sphereBlocks + 32 * b, hit);
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, closest, _CMP_LT_OQ));
+
+                int mask = _mm256_movemask_ps(hit);
+                if (mask == 0)
+                {
+                    continue;
+                }
+
+                // Compaction: only visit the lanes that are closer
+                alignas(32) float distances[8];
+                _mm256_store_ps(distances, t);
+                while (mask != 0)
+                {
+                    int lane = __builtin_ctz(mask);
+                    mask &= mask - 1;
+                    if (distances[lane] < closestDistance)
+                    {
+                        closestDistance = distances[lane];
+                        closestObject = scene.spheres + 28 * (size_t)scene.sphereOrder[8 * b + lane];
+                    }
+                }
+                closest = _mm256_set1_ps(closestDistance);
+            }
+            return false; });
+    }
+
+    /// @brief Is any baked sphere hit closer than maxDistance, 8 spheres at a time, stops at the first block with a hit
+    inline bool AnySphere8(const LightRay &ray, const BakedScene &scene, float maxDistance)
+    {
+        const RayLanes8 lanes(ray);
+        const __m256 maxDistance8 = _mm256_set1_ps(maxDistance);
+        return TraverseSphereBvh(ray, scene, maxDistance, [&](uint32_t firstBlock, uint32_t blockCount)
+                                 {
+            for (size_t b = firstBlock; b < firstBlock + blockCount; b++)
+            {
+                __m256 hit;
+                __m256 t = SphereBlockDistance(lanes, scene.sphereBlocks + 32 * b, hit);
+                if (_mm256_movemask_ps(_mm256_and_ps(hit, _mm256_cmp_ps(t, maxDistance8, _CMP_LT_OQ))) != 0)
+                {
+                    PROFILE_ADD(intersectionTests, 8 * (b - firstBlock + 1));
+                    return true;
+                }
+            }
+            PROFILE_ADD(intersectionTests, 8 * blockCount);
+            return false; });
+    }
+#endif
+
+    /// @brief Finds the closest collision of the ray with the baked scene
+    /// @param scene Baked scene memory
+    /// @param hitObject Set to the baked memory of the hit object, nullptr if nothing was hit
+    /// @return Collision with the closest object, NO_COLLISION if nothing was hit
+    inline Collision MemoryCollision(const LightRay &ray, const BakedScene &scene, const float *&hitObject)
+    {
+        PROFILE_ADD(rays, 1);
+        LocalStats().collisionCalls++;
+        float closestDistance = NO_HIT_DISTANCE;
+        hitObject = nullptr;
+
+#if ISA_LEVEL >= 1
+        ClosestSphere8(ray, scene, closestDistance, hitObject);
+#else
+        ClosestSphere(ray, scene, closestDistance, hitObject);
+#endif
+        ClosestInRange<PlaneDistance>(ray, scene.planes, scene.planeCount, closestDistance, hitObject);
+
+        if (hitObject == nullptr)
+        {
+            return NO_COLLISION;
+        }
+
+        __m128 position = _mm_load_ps(hitObject);
+        __m128 distv = _mm_set_ps1(closestDistance);
+        __m128 point = fmadd(ray.direction, distv, ray.origin);
+        __m128 normal;
+
+        if (hitObject < scene.planes) // Sphere
+        {
+            normal = normalized(_mm_sub_ps(point, position));
+        }
+        else // Plane, normal always faces the incoming ray
+        {
+            normal = _mm_load_ps(hitObject + 8);
+            if (dot(ray.direction, normal) > 0)
+            {
+                normal = flipped(normal);
+            }
+        }
+
+        return {true, point, normal, ray.direction, closestDistance};
+    }
+
+    /// @brief Occlusion query for shadow rays: is anything hit before maxDistance?
+    /// Stops at the first hit and never computes hit point or normal
+    /// @param scene Baked scene memory
+    /// @param maxDistance Only hits closer than this count, NO_HIT_DISTANCE for an unbounded ray
+    /// @return true if the ray is blocked
+    inline bool MemoryOcclusion(const LightRay &ray, const BakedScene &scene, float maxDistance)
+    {
+        PROFILE_ADD(rays, 1);
+        LocalStats().occlusionCalls++;
+#if ISA_LEVEL >= 1
+        if (AnySphere8(ray, scene, maxDistance))
+#else
+        if (AnySphere(ray, scene, maxDistance))
+#endif
+        {
+            return true;
+        }
+        return AnyInRange<PlaneDistance>(ray, scene.planes, scene.planeCount, maxDistance);
+    }
+
+    /// @brief Mirrors the incoming direction and randomly shifts it by the roughness of the material
+    /// @param u Uniform random values in [0, 1) from the sampler
+    inline __m128 SpecularScatter(__m128 incoming, __m128 normal, float roughness, __m128 u)
+    {
+        return normalized(scatter(mirrorToNormalized(incoming, normal), roughness, u));
+    }
+
+    /// @brief Four random lambertian reflections around the normal
+    /// @param u1 Uniform random values in [0, 1) from the sampler, one per direction
+    /// @param u2 Uniform random values in [0, 1) from the sampler, one per direction
+    /// @param directions Output, 4 cosine distributed directions
+    inline void DiffuseScatter(__m128 normal, __m128 u1, __m128 u2, __m128 *directions)
+    {
+        cosineHemisphere4(normal, u1, u2, directions);
+    }
+
+    /// @brief Converts a row of colors to clamped integer channel values
+    /// @param row Colors already scaled to the channel depth
+    /// @param count Pixels in the row
+    /// @param maxValue Largest channel value
+    /// @param out 3 * count RGB values. Needs 4 values of padding at the end, the vector paths store whole registers
+    inline void QuantizeRow(const __m128 *row, int count, int maxValue, int *out)
+    {
+        int x = 0;
+#if ISA_LEVEL >= 2
+        // Four pixels per iteration, compress RGBA x4 into RGB x4
+        const __m512i maxv16 = _mm512_set1_epi32(maxValue);
+        for (; x + 4 <= count; x += 4)
+        {
+            __m512i v = _mm512_cvttps_epi32(_mm512_loadu_ps((const float *)(row + x)));
+            v = _mm512_min_epi32(_mm512_max_epi32(v, _mm512_setzero_si512()), maxv16);
+            _mm512_mask_storeu_epi32(out + 3 * x, 0x0FFF, _mm512_maskz_compress_epi32(0x7777, v));
+        }
+#endif
+#if ISA_LEVEL >= 1
+        // Two pixels per iteration, RGBA RGBA -> RGB RGB
+        const __m256i maxv8 = _mm256_set1_epi32(maxValue);
+        const __m256i packRGB = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+        for (; x + 2 <= count; x += 2)
+        {
+            __m256i v = _mm256_cvttps_epi32(_mm256_loadu_ps((const float *)(row + x)));
+            v = _mm256_min_epi32(_mm256_max_epi32(v, _mm256_setzero_si256()), maxv8);
+            _mm256_storeu_si256((__m256i *)(out + 3 * x), _mm256_permutevar8x32_epi32(v, packRGB));
+        }
+#endif
+        const __m128i maxv4 = _mm_set1_epi32(maxValue);
+        for (; x < count; x++)
+        {
+            __m128i v = _mm_cvttps_epi32(row[x]);
+            v = _mm_min_epi32(_mm_max_epi32(v, _mm_setzero_si128()), maxv4);
+            _mm_storeu_si128((__m128i *)(out + 3 * x), v);
+        }
+    }
+
+    const KernelTable kernels = {
+        ISA_NAME,
+        &MemoryCollision,
+        &MemoryOcclusion,
+        &SpecularScatter,
+        &DiffuseScatter,
+        &QuantizeRow,
+    };
+}
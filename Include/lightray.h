@@ -8,6 +8,8 @@ public:
 
     __m128 direction;
 
+    LightRay() {}
+
     LightRay(__m128 origin, __m128 direction)
     {
         this->origin = origin;
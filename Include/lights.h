@@ -0,0 +1,122 @@
+#include <cmath>
+#include <algorithm>
+
+#include <immintrin.h>
+
+using namespace m128Calc;
+
+/// @brief A direction sampled towards a baked area light
+struct LightSample
+{
+    /// @brief Normalized direction from the shading point towards the light
+    __m128 direction;
+    /// @brief Distance along the direction to the light surface
+    float distance;
+    /// @brief Probability density of the direction, per solid angle. 0 if the light can not be sampled from the point
+    float pdf;
+};
+
+/// @brief 1 - cos of the cone a sphere light covers as seen from a point, 0 if the point is inside the sphere.
+/// Written as sin^2 / (1 + cos) so small and distant lights keep their precision
+inline float SphereLightCone(const float *light, __m128 point, float &distance2)
+{
+    __m128 L = _mm_sub_ps(_mm_load_ps(light), point);
+    distance2 = norm2(L);
+    float radius2 = light[4] * light[4];
+    if (distance2 <= radius2)
+    {
+        return 0.0f;
+    }
+    float sin2Max = radius2 / distance2;
+    return sin2Max / (1.0f + std::sqrt(1.0f - sin2Max));
+}
+
+/// @brief Samples a direction uniformly inside the cone a baked sphere light covers as seen from the point
+/// @param u1 Uniform random number in [0, 1)
+/// @param u2 Uniform random number in [0, 1)
+inline LightSample SampleSphereLight(const float *light, __m128 point, float u1, float u2)
+{
+    LightSample sample = {_mm_setzero_ps(), 0.0f, 0.0f};
+    float distance2;
+    float oneMinusCosMax = SphereLightCone(light, point, distance2);
+    if (oneMinusCosMax <= 0)
+    {
+        return sample;
+    }
+
+    float cosTheta = 1.0f - u1 * oneMinusCosMax;
+    float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+    float phi = 2.0f * 3.1415926535f * u2;
+
+    __m128 L = _mm_sub_ps(_mm_load_ps(light), point);
+    __m128 axis = _mm_mul_ps(L, _mm_set1_ps(1.0f / std::sqrt(distance2)));
+    __m128 tangent, bitangent;
+    orthonormalBasis(axis, tangent, bitangent);
+    sample.direction = fmadd(tangent, _mm_set1_ps(sinTheta * std::cos(phi)),
+                             fmadd(bitangent, _mm_set1_ps(sinTheta * std::sin(phi)),
+                                   _mm_mul_ps(axis, _mm_set1_ps(cosTheta))));
+
+    // Near intersection with the sphere
+    float tca = dot(L, sample.direction);
+    float radius2 = light[4] * light[4];
+    sample.distance = tca - std::sqrt(std::max(radius2 - (distance2 - tca * tca), 0.0f));
+    sample.pdf = 1.0f / (2.0f * 3.1415926535f * oneMinusCosMax);
+    return sample;
+}
+
+/// @brief Samples a point uniformly on the area of a baked plane light. Planes emit to both sides
+/// @param u1 Uniform random number in [0, 1)
+/// @param u2 Uniform random number in [0, 1)
+inline LightSample SamplePlaneLight(const float *light, __m128 point, float u1, float u2)
+{
+    LightSample sample = {_mm_setzero_ps(), 0.0f, 0.0f};
+    __m128 normal = _mm_load_ps(light + 8);
+    __m128 localX = _mm_load_ps(light + 12);
+    __m128 localY = _mm_load_ps(light + 16);
+    float scaleX = light[4];
+    float scaleY = light[5];
+
+    __m128 target = fmadd(localX, _mm_set1_ps((2.0f * u1 - 1.0f) * scaleX),
+                          fmadd(localY, _mm_set1_ps((2.0f * u2 - 1.0f) * scaleY), _mm_load_ps(light)));
+    __m128 toLight = _mm_sub_ps(target, point);
+    float distance2 = norm2(toLight);
+    if (distance2 <= 0)
+    {
+        return sample;
+    }
+    sample.distance = std::sqrt(distance2);
+    sample.direction = _mm_mul_ps(toLight, _mm_set1_ps(1.0f / sample.distance));
+
+    // Area density converted to solid angle
+    float cosLight = std::abs(dot(sample.direction, normal));
+    float area = 4.0f * scaleX * scaleY;
+    sample.pdf = cosLight > 1e-6f ? distance2 / (cosLight * area) : 0.0f;
+    return sample;
+}
+
+/// @brief Samples a direction towards a baked sphere or plane light
+inline LightSample SampleLight(const float *light, __m128 point, float u1, float u2)
+{
+    char type = *(const char *)(light + 26);
+    return type == 0 ? SampleSphereLight(light, point, u1, u2) : SamplePlaneLight(light, point, u1, u2);
+}
+
+/// @brief Density of SampleLight producing a ray that hits the light
+/// @param origin Origin of the ray
+/// @param direction Normalized direction of the ray
+/// @param distance Distance along the ray to the hit on the light
+/// @return Density per solid angle
+inline float LightPdf(const float *light, __m128 origin, __m128 direction, float distance)
+{
+    char type = *(const char *)(light + 26);
+    if (type == 0) // Sphere
+    {
+        float distance2;
+        float oneMinusCosMax = SphereLightCone(light, origin, distance2);
+        return oneMinusCosMax > 0 ? 1.0f / (2.0f * 3.1415926535f * oneMinusCosMax) : 0.0f;
+    }
+    // Plane
+    float cosLight = std::abs(dot(direction, _mm_load_ps(light + 8)));
+    float area = 4.0f * light[4] * light[5];
+    return cosLight > 1e-6f ? distance * distance / (cosLight * area) : 0.0f;
+}
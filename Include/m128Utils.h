@@ -1,3 +1,4 @@
+#pragma once
 #include <xmmintrin.h> // Vector instrinsics
 #include <pmmintrin.h> // SSE3
 #include <immintrin.h>
@@ -23,7 +24,7 @@ namespace m128Calc
         __m128 result = _mm_dp_ps(a, b, 0b01110001);
         return _mm_cvtss_f32(result);
     }
-    __m128 cross(__m128 a, __m128 b)
+    inline __m128 cross(__m128 a, __m128 b)
     {
         // Shuffle components for cross product calculation
         __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); // (a_y, a_z, a_x, 0)
@@ -55,12 +56,26 @@ namespace m128Calc
     {
         return std::to_string(getX(v)) + ", " + std::to_string(getY(v)) + ", " + std::to_string(getZ(v)) + ", " + std::to_string(getW(v));
     }
+    /// @brief Perceived brightness of a linear RGB color (Rec. 709 weights)
+    inline float luminance(__m128 color)
+    {
+        return dot(color, _mm_setr_ps(0.2126f, 0.7152f, 0.0722f, 0));
+    }
     inline __m128 mirrorToNormalized(__m128 v, __m128 mirror)
     {
         __m128 dotv = _mm_set1_ps(dot(v, mirror) * 2);
         __m128 scaledMirror = _mm_mul_ps(dotv, mirror);
         return _mm_sub_ps(v, scaledMirror);
     }
+    /// @brief a * b + c. Fused on FMA builds, the dispatched AVX2 kernels contract it to FMA as well
+    inline __m128 fmadd(__m128 a, __m128 b, __m128 c)
+    {
+#ifdef __FMA__
+        return _mm_fmadd_ps(a, b, c);
+#else
+        return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+    }
     inline __m128 radToEuler(__m128 v)
     {
         __m128 mult = _mm_set1_ps(180.0f / 3.1415926535f);
@@ -78,7 +93,7 @@ namespace m128Calc
     }
 
     /// @brief Gives a random float vector in the range [-1, 1]
-    __m128 randomvec(__m128i &seedVector)
+    inline __m128 randomvec(__m128i &seedVector)
     {
         // Increment each component of the seed vector with different constants
         seedVector = _mm_xor_si128(seedVector, _mm_slli_epi32(seedVector, 13)); // Xorshift step 1
@@ -102,11 +117,12 @@ namespace m128Calc
 
     /// @brief Randomly shift the vector by a tiny amount
     /// @param strength How far the changed vector is from the original
-    inline __m128 scatter(__m128 v, float strength, __m128i &seed)
+    /// @param u Uniform random values in [0, 1), one per component
+    inline __m128 scatter(__m128 v, float strength, __m128 u)
     {
-        __m128 scatter = randomvec(seed);
+        __m128 scatter = fmadd(u, _mm_set1_ps(2.0f), _mm_set1_ps(-1.0f)); // [-1, 1)
         __m128 strengthv = _mm_set1_ps(strength);
-        return _mm_fmadd_ps(scatter, strengthv, v);
+        return fmadd(scatter, strengthv, v);
     }
 
     /// @brief Generates a random vector inside a unit sphere. Probability is uniformly distributed
@@ -123,11 +139,96 @@ namespace m128Calc
         return rand;
     }
 
-    inline __m128 diffuseScatter(__m128 normalDir, __m128i &rngSeed)
+    /// @brief Builds two tangents that form an orthonormal basis with the normalized vector n (Duff et al.), no branches
+    inline void orthonormalBasis(__m128 n, __m128 &tangent, __m128 &bitangent)
+    {
+        float x = getX(n);
+        float y = getY(n);
+        float z = getZ(n);
+        float sign = std::copysign(1.0f, z);
+        float a = -1.0f / (sign + z);
+        float b = x * y * a;
+        tangent = _mm_setr_ps(1.0f + sign * x * x * a, sign * b, -sign * x, 0);
+        bitangent = _mm_setr_ps(b, sign + y * y * a, -y, 0);
+    }
+
+    /// @brief Sine and cosine of 2 * pi * t for 4 values at once, without branches.
+    /// The angle is split into a quadrant and an angle in [0, pi / 2), which is evaluated with short polynomials
+    /// @param t Values in [0, 1)
+    inline void sincos2pi(__m128 t, __m128 &sine, __m128 &cosine)
     {
-        // Lambertian reflection
-        __m128 random_in_unit = random_in_unit_sphere(rngSeed);
-        __m128 reflected = _mm_add_ps(normalDir, random_in_unit);
-        return normalized(reflected);
+        __m128 quadrants = _mm_floor_ps(_mm_mul_ps(t, _mm_set1_ps(4.0f)));
+        __m128 a = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(4.0f)), quadrants), _mm_set1_ps(3.1415926535f / 2));
+        __m128 a2 = _mm_mul_ps(a, a);
+
+        // Taylor series, error below 4e-6 on [0, pi / 2)
+        __m128 s = fmadd(a2, _mm_set1_ps(1.0f / 362880), _mm_set1_ps(-1.0f / 5040));
+        s = fmadd(a2, s, _mm_set1_ps(1.0f / 120));
+        s = fmadd(a2, s, _mm_set1_ps(-1.0f / 6));
+        s = fmadd(_mm_mul_ps(a2, a), s, a);
+        __m128 c = fmadd(a2, _mm_set1_ps(-1.0f / 3628800), _mm_set1_ps(1.0f / 40320));
+        c = fmadd(a2, c, _mm_set1_ps(-1.0f / 720));
+        c = fmadd(a2, c, _mm_set1_ps(1.0f / 24));
+        c = fmadd(a2, c, _mm_set1_ps(-0.5f));
+        c = fmadd(a2, c, _mm_set1_ps(1.0f));
+
+        // Rotate by the quadrant: 1 swaps (s, c) -> (c, -s), 2 negates both, 3 does both
+        __m128i q = _mm_cvtps_epi32(quadrants);
+        __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+        __m128 sineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_srli_epi32(q, 1), 31));
+        __m128 cosineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_srli_epi32(_mm_add_epi32(q, _mm_set1_epi32(1)), 1), 31));
+        sine = _mm_xor_ps(_mm_blendv_ps(s, c, swap), sineSign);
+        cosine = _mm_xor_ps(_mm_blendv_ps(c, s, swap), cosineSign);
+    }
+
+    /// @brief e^x for 4 values at once, without branches. Split into 2^n * 2^f, 2^n is built in the exponent bits,
+    /// 2^f with f in [0, 1) by a short polynomial. Relative error below 2e-5, inputs are clamped to the float range
+    inline __m128 exp4(__m128 x)
+    {
+        x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-87.0f)), _mm_set1_ps(88.0f));
+        __m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f)); // log2(e)
+        __m128 n = _mm_floor_ps(t);
+        __m128 f = _mm_mul_ps(_mm_sub_ps(t, n), _mm_set1_ps(0.693147181f)); // ln(2)
+
+        // Taylor series of e^f for f in [0, ln 2)
+        __m128 p = fmadd(f, _mm_set1_ps(1.0f / 720), _mm_set1_ps(1.0f / 120));
+        p = fmadd(f, p, _mm_set1_ps(1.0f / 24));
+        p = fmadd(f, p, _mm_set1_ps(1.0f / 6));
+        p = fmadd(f, p, _mm_set1_ps(0.5f));
+        p = fmadd(f, p, _mm_set1_ps(1.0f));
+        p = fmadd(f, p, _mm_set1_ps(1.0f));
+
+        __m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+        return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+    }
+
+    /// @brief Four cosine distributed directions in the hemisphere around the normal, pdf = cos(theta) / pi.
+    /// Uniform point on the disk projected up onto the hemisphere (Malley), placed in an orthonormal basis around the normal.
+    /// No rejection loop and no branches
+    /// @param normal Normalized normal
+    /// @param u1 Uniform values in [0, 1), one per direction
+    /// @param u2 Uniform values in [0, 1), one per direction
+    /// @param directions Output, 4 normalized directions
+    inline void cosineHemisphere4(__m128 normal, __m128 u1, __m128 u2, __m128 *directions)
+    {
+        __m128 tangent, bitangent;
+        orthonormalBasis(normal, tangent, bitangent);
+
+        // Local coordinates of the 4 samples, one sample per lane
+        __m128 sine, cosine;
+        sincos2pi(u2, sine, cosine);
+        __m128 r = _mm_sqrt_ps(u1);
+        __m128 lx = _mm_mul_ps(r, cosine);
+        __m128 ly = _mm_mul_ps(r, sine);
+        __m128 lz = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(1.0f), u1), _mm_setzero_ps()));
+
+        alignas(16) float x[4], y[4], z[4];
+        _mm_store_ps(x, lx);
+        _mm_store_ps(y, ly);
+        _mm_store_ps(z, lz);
+        for (int i = 0; i < 4; i++)
+        {
+            directions[i] = fmadd(tangent, _mm_set1_ps(x[i]), fmadd(bitangent, _mm_set1_ps(y[i]), _mm_mul_ps(normal, _mm_set1_ps(z[i]))));
+        }
     }
 }
\ No newline at end of file
@@ -2,63 +2,629 @@
 #include <string.h>
 #include <cstdlib>
 #include <memory>
+#include <fstream>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
 
-// Cross-platform aligned allocation
-char *allocate_aligned(size_t alignment, size_t size)
+#include "alignedmemory.h"
+
+/// @brief Writes a single object into its 28 float memory slot
+/// @param object_memory_start 16 byte aligned start of the slot
+/// @param object Scene Object in OOP
+/// @param id Object id for the auxiliary outputs, position in the scene file starting at 1
+inline void bake_object(float *object_memory_start, Object *object, int32_t id)
+{
+    _mm_store_ps(object_memory_start, object->position);
+    _mm_store_ps(object_memory_start + 4, object->scale);
+
+    // Other object data
+    if (object->object_type == 1) // Plane
+    {
+        // Normal
+        _mm_store_ps(object_memory_start + 8, ((Plane *)object)->normal);
+        // Local X
+        _mm_store_ps(object_memory_start + 12, ((Plane *)object)->localX);
+        // Local Y
+        _mm_store_ps(object_memory_start + 16, ((Plane *)object)->localY);
+    }
+
+    // Material color
+    _mm_store_ps(object_memory_start + 20, object->mat.color);
+
+    // Material intensity
+    std::memcpy(object_memory_start + 24, &(object->mat.intensity), 4);
+
+    // Material diffuse
+    std::memcpy(object_memory_start + 25, &(object->mat.diffuse), 4);
+
+    // Obj type
+    std::memcpy(object_memory_start + 26, &(object->object_type), 1);
+
+    // Object id
+    std::memcpy(object_memory_start + 27, &id, 4);
+}
+
+/// @brief Header of a binary baked object file (.baked). Followed by the 28 float slots of bake_object,
+/// all spheres first, then all planes. Native byte order, written by the scenegen tool
+struct BakedFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t floatsPerObject;
+    uint64_t sphereCount;
+    uint64_t planeCount;
+};
+
+const char BAKED_FILE_MAGIC[8] = "RTBAKED";
+const uint32_t BAKED_FILE_VERSION = 1;
+
+inline BakedFileHeader make_baked_header(uint64_t sphereCount, uint64_t planeCount)
+{
+    BakedFileHeader header;
+    std::memcpy(header.magic, BAKED_FILE_MAGIC, sizeof(header.magic));
+    header.version = BAKED_FILE_VERSION;
+    header.floatsPerObject = 28;
+    header.sphereCount = sphereCount;
+    header.planeCount = planeCount;
+    return header;
+}
+
+/// @brief Reads and checks the header of a baked object file
+/// @return false if the file is missing, not a baked object file of this version, or its size does not match the object counts
+inline bool read_baked_header(std::ifstream &file, BakedFileHeader &header)
+{
+    if (!file.read((char *)&header, sizeof(header)))
+    {
+        return false;
+    }
+    if (std::memcmp(header.magic, BAKED_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != BAKED_FILE_VERSION ||
+        header.floatsPerObject != 28)
+    {
+        return false;
+    }
+
+    // The counts decide the allocation size, a corrupt header must not get that far
+    file.seekg(0, std::ios::end);
+    const std::streamoff fileSize = file.tellg();
+    if (!file || fileSize < (std::streamoff)sizeof(header))
+    {
+        return false;
+    }
+    const uint64_t bodyObjects = (uint64_t)(fileSize - (std::streamoff)sizeof(header)) / 112;
+    return (uint64_t)(fileSize - (std::streamoff)sizeof(header)) % 112 == 0 && header.sphereCount <= bodyObjects &&
+           header.planeCount == bodyObjects - header.sphereCount;
+}
+
+/// @brief Copies count object slots of one type from a baked object file into memory
+/// @param idOffset Added to the stored object ids, so they continue after the objects of the scene file
+/// @return Number of objects copied, 0 if the file could not be read
+inline size_t load_baked_range(std::ifstream &file, const BakedFileHeader &header, char type, float *memory, int32_t idOffset)
+{
+    const size_t count = type == 0 ? header.sphereCount : header.planeCount;
+    const size_t first = type == 0 ? 0 : header.sphereCount;
+    file.clear();
+    file.seekg(sizeof(BakedFileHeader) + first * 112);
+    if (!file.read((char *)memory, count * 112))
+    {
+        std::cerr << "SCENE ERROR: BAKED FILE TRUNCATED, SKIPPING ITS OBJECTS" << std::endl;
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        int32_t id;
+        std::memcpy(&id, memory + 28 * i + 27, 4);
+        id += idOffset;
+        std::memcpy(memory + 28 * i + 27, &id, 4);
+    }
+    return count;
+}
+
+/// @brief Lane of sphereOrder without a sphere
+const uint32_t BVH_PADDING = UINT32_MAX;
+/// @brief Centroid bins per axis of the SAH split search
+const int BVH_BINS = 16;
+/// @brief Leaves get at most this many sphere blocks, unless the spheres can not be split any further
+const uint32_t BVH_MAX_LEAF_BLOCKS = 4;
+/// @brief Deeper nodes become leaves, keeps the traversal stack bounded
+const int BVH_MAX_DEPTH = 48;
+/// @brief SAH costs of visiting a node and of testing one sphere block, relative to each other
+const float BVH_NODE_COST = 2.0f;
+const float BVH_BLOCK_COST = 1.0f;
+
+/// @brief Axis aligned box while building, min and max in xyz
+struct BvhBounds
+{
+    __m128 min = _mm_set1_ps(INFINITY);
+    __m128 max = _mm_set1_ps(-INFINITY);
+
+    inline void Grow(__m128 lower, __m128 upper)
+    {
+        min = _mm_min_ps(min, lower);
+        max = _mm_max_ps(max, upper);
+    }
+
+    inline void Grow(const BvhBounds &other) { Grow(other.min, other.max); }
+
+    /// @brief Half the surface area, 0 for empty boxes
+    inline float Area() const
+    {
+        alignas(16) float e[4];
+        _mm_store_ps(e, _mm_max_ps(_mm_sub_ps(max, min), _mm_setzero_ps()));
+        return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+    }
+};
+
+/// @brief Bounds of a baked sphere
+inline void sphere_bounds(const float *sphere, __m128 &lower, __m128 &upper)
+{
+    __m128 center = _mm_load_ps(sphere);
+    __m128 radius = _mm_set1_ps(sphere[4]);
+    lower = _mm_sub_ps(center, radius);
+    upper = _mm_add_ps(center, radius);
+}
+
+inline void store_node_bounds(BvhNode &node, const BvhBounds &bounds)
+{
+    alignas(16) float lower[4], upper[4];
+    _mm_store_ps(lower, bounds.min);
+    _mm_store_ps(upper, bounds.max);
+    std::memcpy(node.min, lower, 12);
+    std::memcpy(node.max, upper, 12);
+}
+
+inline BvhBounds load_node_bounds(const BvhNode &node)
+{
+    BvhBounds bounds;
+    bounds.min = _mm_set_ps(0, node.min[2], node.min[1], node.min[0]);
+    bounds.max = _mm_set_ps(0, node.max[2], node.max[1], node.max[0]);
+    return bounds;
+}
+
+/// @brief Expected cost of a ray through the tree relative to the root (surface area heuristic).
+/// Rises when refitted boxes grow and overlap, see update_sphere_bvh
+inline float bvh_sah_cost(const BakedScene &baked)
+{
+    if (baked.bvhNodeCount == 0)
+    {
+        return 0;
+    }
+    double cost = 0;
+#pragma omp parallel for reduction(+ : cost) schedule(static)
+    for (size_t n = 0; n < baked.bvhNodeCount; n++)
+    {
+        const BvhNode &node = baked.bvhNodes[n];
+        cost += load_node_bounds(node).Area() * (node.count == 0 ? BVH_NODE_COST : BVH_BLOCK_COST * node.count);
+    }
+    return (float)(cost / std::max(load_node_bounds(baked.bvhNodes[0]).Area(), 1e-12f));
+}
+
+/// @brief Writes the spheres of a leaf into its blocks, padding lanes are never hit
+inline void write_leaf_blocks(BakedScene &baked, const BvhNode &leaf)
+{
+    for (uint32_t lane = 8 * leaf.first; lane < 8 * (leaf.first + leaf.count); lane++)
+    {
+        float *block = baked.sphereBlocks + 32 * (lane / 8);
+        uint32_t sphereIndex = baked.sphereOrder[lane];
+        if (sphereIndex != BVH_PADDING)
+        {
+            const float *sphere = baked.spheres + 28 * (size_t)sphereIndex;
+            block[lane % 8] = sphere[0];
+            block[8 + lane % 8] = sphere[1];
+            block[16 + lane % 8] = sphere[2];
+            block[24 + lane % 8] = sphere[4] * sphere[4];
+        }
+        else
+        {
+            block[lane % 8] = 0;
+            block[8 + lane % 8] = 0;
+            block[16 + lane % 8] = 0;
+            block[24 + lane % 8] = -1;
+        }
+    }
+}
+
+/// @brief Builds the sphere BVH and the sphere blocks from the baked spheres, replaces any previous build.
+/// Binned SAH, one tree level at a time: the nodes of a level are split in parallel, so the node order is breadth first
+/// and every level is a contiguous node range for the refit
+inline void build_sphere_bvh(BakedScene &baked)
 {
-#ifdef _WIN32
-    return static_cast<char *>(_aligned_malloc(size, alignment)); // Use _aligned_malloc on Windows
-#else
-    return static_cast<char *>(aligned_alloc(alignment, size)); // Use aligned_alloc on Linux
-#endif
+    const double buildStart = omp_get_wtime();
+    free_aligned(baked.sphereBlocks);
+    free_aligned(baked.sphereOrder);
+    free_aligned(baked.bvhNodes);
+    free(baked.bvhLevels);
+
+    /// @brief Bounds of one sphere, the sphere index is stored in the unused fourth lane of lower.
+    /// Partitioned in place, so every node works on a contiguous range and never touches the scattered slots
+    struct Primitive
+    {
+        __m128 lower;
+        __m128 upper;
+    };
+    const size_t sphereCount = baked.sphereCount;
+    Primitive *primitives = (Primitive *)allocate_aligned(16, sizeof(Primitive) * std::max(sphereCount, (size_t)1));
+    BvhBounds rootBounds;
+    BvhBounds rootCentroids;
+    for (size_t i = 0; i < sphereCount; i++)
+    {
+        Primitive &primitive = primitives[i];
+        sphere_bounds(baked.spheres + 28 * i, primitive.lower, primitive.upper);
+        rootBounds.Grow(primitive.lower, primitive.upper);
+        __m128 centroid = _mm_mul_ps(_mm_add_ps(primitive.lower, primitive.upper), _mm_set1_ps(0.5f));
+        rootCentroids.Grow(centroid, centroid);
+        primitive.lower = _mm_castsi128_ps(_mm_insert_epi32(_mm_castps_si128(primitive.lower), (int)i, 3));
+    }
+
+    /// @brief Spheres of a node: range of primitives, bounds of the spheres and of their centroids
+    struct NodeRange
+    {
+        uint32_t start;
+        uint32_t count;
+        BvhBounds bounds;
+        BvhBounds centroids;
+    };
+    /// @brief Result of the split search of a node
+    struct NodeSplit
+    {
+        bool leaf;
+        uint32_t leftCount;
+        BvhBounds left, leftCentroids;
+        BvhBounds right, rightCentroids;
+    };
+    /// @brief Spheres whose centroid falls into one bin of one axis
+    struct Bin
+    {
+        BvhBounds bounds;
+        BvhBounds centroids;
+        uint32_t count = 0;
+    };
+
+    std::vector<BvhNode> nodes;
+    std::vector<NodeRange> ranges;
+    std::vector<uint32_t> levels;
+    uint32_t blockCount = 0;
+    if (sphereCount > 0)
+    {
+        nodes.push_back({});
+        ranges.push_back({0, (uint32_t)sphereCount, rootBounds, rootCentroids});
+    }
+
+    for (size_t levelStart = 0; levelStart < nodes.size();)
+    {
+        const size_t levelEnd = nodes.size();
+        levels.push_back((uint32_t)levelStart);
+        const bool lastLevel = (int)levels.size() >= BVH_MAX_DEPTH;
+        std::vector<NodeSplit> splits(levelEnd - levelStart);
+
+#pragma omp parallel for schedule(dynamic)
+        for (size_t n = levelStart; n < levelEnd; n++)
+        {
+            const NodeRange &range = ranges[n];
+            NodeSplit &split = splits[n - levelStart];
+            const uint32_t leafBlocks = (range.count + 7) / 8;
+            split.leaf = true;
+            if (range.count <= 8 || lastLevel)
+            {
+                continue;
+            }
+
+            const __m128 centroidMin = range.centroids.min;
+            const __m128 extent = _mm_sub_ps(range.centroids.max, centroidMin);
+            const __m128 binScale = _mm_div_ps(_mm_set1_ps(BVH_BINS * 0.9999f), _mm_max_ps(extent, _mm_set1_ps(1e-20f)));
+            Primitive *begin = primitives + range.start;
+            Primitive *end = begin + range.count;
+
+            // Bins of all three axes in one pass
+            Bin bins[3][BVH_BINS];
+            for (const Primitive *primitive = begin; primitive < end; primitive++)
+            {
+                __m128 centroid = _mm_mul_ps(_mm_add_ps(primitive->lower, primitive->upper), _mm_set1_ps(0.5f));
+                alignas(16) int bin[4];
+                _mm_store_si128((__m128i *)bin, _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(centroid, centroidMin), binScale)));
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    Bin &target = bins[axis][bin[axis]];
+                    target.bounds.Grow(primitive->lower, primitive->upper);
+                    target.centroids.Grow(centroid, centroid);
+                    target.count++;
+                }
+            }
+
+            // Sweep: cost of every split plane between two bins
+            alignas(16) float extents[4];
+            _mm_store_ps(extents, extent);
+            const float parentArea = range.bounds.Area();
+            float bestCost = BVH_BLOCK_COST * leafBlocks;
+            int bestAxis = -1;
+            int bestBin = 0;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                if (extents[axis] <= 0)
+                {
+                    continue;
+                }
+                float rightArea[BVH_BINS];
+                uint32_t rightCount[BVH_BINS];
+                BvhBounds right;
+                uint32_t count = 0;
+                for (int b = BVH_BINS - 1; b > 0; b--)
+                {
+                    right.Grow(bins[axis][b].bounds);
+                    count += bins[axis][b].count;
+                    rightArea[b] = right.Area();
+                    rightCount[b] = count;
+                }
+                BvhBounds left;
+                count = 0;
+                for (int b = 1; b < BVH_BINS; b++)
+                {
+                    left.Grow(bins[axis][b - 1].bounds);
+                    count += bins[axis][b - 1].count;
+                    if (count == 0 || rightCount[b] == 0)
+                    {
+                        continue;
+                    }
+                    float cost = BVH_NODE_COST + BVH_BLOCK_COST * (left.Area() * count + rightArea[b] * rightCount[b]) / (8 * parentArea);
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = b;
+                    }
+                }
+            }
+
+            if (bestAxis < 0 && leafBlocks <= BVH_MAX_LEAF_BLOCKS)
+            {
+                continue;
+            }
+            split.leaf = false;
+
+            if (bestAxis >= 0)
+            {
+                const float axisMin = ((const float *)&centroidMin)[bestAxis];
+                const float axisScale = ((const float *)&binScale)[bestAxis];
+                Primitive *middle = std::partition(begin, end, [&](const Primitive &primitive)
+                                                   {
+                    float centroid = 0.5f * (((const float *)&primitive.lower)[bestAxis] + ((const float *)&primitive.upper)[bestAxis]);
+                    return (int)((centroid - axisMin) * axisScale) < bestBin; });
+                split.leftCount = (uint32_t)(middle - begin);
+                for (int b = 0; b < BVH_BINS; b++)
+                {
+                    const Bin &bin = bins[bestAxis][b];
+                    (b < bestBin ? split.left : split.right).Grow(bin.bounds);
+                    (b < bestBin ? split.leftCentroids : split.rightCentroids).Grow(bin.centroids);
+                }
+            }
+            else
+            {
+                // No useful plane but too many spheres for a leaf, e.g. all at the same spot: split in the middle of the range
+                split.leftCount = range.count / 2;
+                for (const Primitive *primitive = begin; primitive < end; primitive++)
+                {
+                    __m128 centroid = _mm_mul_ps(_mm_add_ps(primitive->lower, primitive->upper), _mm_set1_ps(0.5f));
+                    bool left = primitive < begin + split.leftCount;
+                    (left ? split.left : split.right).Grow(primitive->lower, primitive->upper);
+                    (left ? split.leftCentroids : split.rightCentroids).Grow(centroid, centroid);
+                }
+            }
+        }
+
+        // Children are appended in level order, so the next level is again one contiguous range
+        for (size_t n = levelStart; n < levelEnd; n++)
+        {
+            const NodeSplit &split = splits[n - levelStart];
+            const NodeRange range = ranges[n];
+            store_node_bounds(nodes[n], range.bounds);
+            if (split.leaf)
+            {
+                nodes[n].first = blockCount;
+                nodes[n].count = (range.count + 7) / 8;
+                blockCount += nodes[n].count;
+                continue;
+            }
+            nodes[n].first = (uint32_t)nodes.size();
+            nodes[n].count = 0;
+            nodes.push_back({});
+            nodes.push_back({});
+            ranges.push_back({range.start, split.leftCount, split.left, split.leftCentroids});
+            ranges.push_back({range.start + split.leftCount, range.count - split.leftCount, split.right, split.rightCentroids});
+        }
+        levelStart = levelEnd;
+    }
+    levels.push_back((uint32_t)nodes.size());
+
+    baked.bvhNodeCount = nodes.size();
+    baked.bvhNodes = (BvhNode *)allocate_aligned(32, sizeof(BvhNode) * std::max(nodes.size(), (size_t)1));
+    std::memcpy(baked.bvhNodes, nodes.data(), sizeof(BvhNode) * nodes.size());
+    baked.bvhLevelCount = levels.size() - 1;
+    baked.bvhLevels = (uint32_t *)malloc(sizeof(uint32_t) * levels.size());
+    std::memcpy(baked.bvhLevels, levels.data(), sizeof(uint32_t) * levels.size());
+
+    // Blocks in leaf order, every leaf starts a new block
+    baked.sphereBlockCount = blockCount;
+    baked.sphereBlocks = (float *)allocate_aligned(32, 128 * std::max((size_t)blockCount, (size_t)1));
+    baked.sphereOrder = (uint32_t *)allocate_aligned(32, 32 * std::max((size_t)blockCount, (size_t)1));
+#pragma omp parallel for schedule(dynamic, 64)
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        if (nodes[n].count == 0)
+        {
+            continue;
+        }
+        const uint32_t lanes = 8 * nodes[n].count;
+        for (uint32_t lane = 0; lane < lanes; lane++)
+        {
+            baked.sphereOrder[8 * nodes[n].first + lane] =
+                lane < ranges[n].count ? (uint32_t)_mm_extract_epi32(_mm_castps_si128(primitives[ranges[n].start + lane].lower), 3) : BVH_PADDING;
+        }
+        write_leaf_blocks(baked, nodes[n]);
+    }
+
+    free_aligned(primitives);
+    baked.bvhBuildCost = bvh_sah_cost(baked);
+    tracer.Record("acceleration build", "setup", buildStart, omp_get_wtime());
 }
 
-// Cross-platform aligned free
-void free_aligned(void *ptr)
+/// @brief Updates the sphere blocks and the node bounds after spheres moved, the tree itself is kept.
+/// Bottom up one level at a time, the nodes of a level in parallel
+inline void refit_sphere_bvh(BakedScene &baked)
 {
-#ifdef _WIN32
-    _aligned_free(ptr); // Use _aligned_free on Windows
-#else
-    free(ptr); // Use free on Linux
-#endif
+    TRACE_SCOPE("bvh refit", "animation");
+    for (size_t level = baked.bvhLevelCount; level-- > 0;)
+    {
+#pragma omp parallel for schedule(dynamic, 64)
+        for (uint32_t n = baked.bvhLevels[level]; n < baked.bvhLevels[level + 1]; n++)
+        {
+            BvhNode &node = baked.bvhNodes[n];
+            BvhBounds bounds;
+            if (node.count == 0)
+            {
+                bounds = load_node_bounds(baked.bvhNodes[node.first]);
+                bounds.Grow(load_node_bounds(baked.bvhNodes[node.first + 1]));
+            }
+            else
+            {
+                write_leaf_blocks(baked, node);
+                for (uint32_t lane = 8 * node.first; lane < 8 * (node.first + node.count); lane++)
+                {
+                    if (baked.sphereOrder[lane] != BVH_PADDING)
+                    {
+                        __m128 lower, upper;
+                        sphere_bounds(baked.spheres + 28 * (size_t)baked.sphereOrder[lane], lower, upper);
+                        bounds.Grow(lower, upper);
+                    }
+                }
+            }
+            store_node_bounds(node, bounds);
+        }
+    }
 }
 
-/// @brief Bakes the objects inside the scene into memory
+/// @brief Brings the BVH up to date after spheres moved: refits, and rebuilds when the refitted tree got too slow
+/// @param rebuildRatio Rebuild when the SAH cost of the refitted tree exceeds the cost after the last build by this factor
+/// @return true if the tree was rebuilt
+inline bool update_sphere_bvh(BakedScene &baked, float rebuildRatio)
+{
+    refit_sphere_bvh(baked);
+    if (bvh_sah_cost(baked) <= baked.bvhBuildCost * rebuildRatio)
+    {
+        return false;
+    }
+    build_sphere_bvh(baked);
+    return true;
+}
+
+/// @brief Bakes the objects inside the scene into memory, grouped by object type
 /// @param objectsInScene Scene Objects in OOP
-/// @return Start of memory block
-float *bake_into_memory(std::vector<Object *> &objectsInScene)
+/// @param bakedFiles Binary baked object files, copied in after the scene objects of the same type
+/// @return Baked scene, free with free_baked_scene
+inline BakedScene bake_into_memory(std::vector<Object *> &objectsInScene, const std::vector<std::string> &bakedFiles = {})
 {
+    // Headers first, the memory is allocated once for everything
+    std::vector<std::ifstream> files;
+    std::vector<BakedFileHeader> headers;
     size_t objectCount = objectsInScene.size();
-    float *memory_start = (float *)allocate_aligned(16, 112 * objectCount); // void* arithmetic causes warnings, use float* instead
-    for (size_t i = 0; i < objectCount; i++)
+    for (const std::string &path : bakedFiles)
     {
-        float *object_memory_start = memory_start + 28 * i;
+        std::ifstream file(path, std::ios::binary);
+        BakedFileHeader header;
+        if (!read_baked_header(file, header))
+        {
+            std::cerr << "SCENE ERROR: INVALID BAKED FILE " << path << std::endl;
+            continue;
+        }
+        objectCount += header.sphereCount + header.planeCount;
+        files.push_back(std::move(file));
+        headers.push_back(header);
+    }
 
-        _mm_store_ps(object_memory_start, objectsInScene[i]->position);
-        _mm_store_ps(object_memory_start + 4, objectsInScene[i]->scale);
+    BakedScene baked;
+    baked.memory = (float *)allocate_aligned(16, 112 * std::max(objectCount, (size_t)1)); // void* arithmetic causes warnings, use float* instead
+    if (baked.memory == nullptr && !files.empty())
+    {
+        std::cerr << "SCENE ERROR: NOT ENOUGH MEMORY FOR THE BAKED FILES, SKIPPING THEM" << std::endl;
+        files.clear();
+        headers.clear();
+        objectCount = objectsInScene.size();
+        baked.memory = (float *)allocate_aligned(16, 112 * std::max(objectCount, (size_t)1));
+    }
+    baked.sphereCount = 0;
+    baked.planeCount = 0;
+    if (baked.memory == nullptr)
+    {
+        std::cerr << "SCENE ERROR: NOT ENOUGH MEMORY TO BAKE THE SCENE" << std::endl;
+        files.clear();
+    }
 
-        // Other object data
-        if (objectsInScene[i]->object_type == 1) // Plane
+    // Spheres first, then planes. Keeps scene order inside each type, baked files follow the scene objects
+    float *object_memory_start = baked.memory;
+    for (char type = 0; type <= 1 && baked.memory != nullptr; type++)
+    {
+        for (size_t i = 0; i < objectsInScene.size(); i++)
         {
-            // Normal
-            _mm_store_ps(object_memory_start + 8, ((Plane *)(objectsInScene[i]))->normal);
-            // Local X
-            _mm_store_ps(object_memory_start + 12, ((Plane *)(objectsInScene[i]))->localX);
-            // Local Y
-            _mm_store_ps(object_memory_start + 16, ((Plane *)(objectsInScene[i]))->localY);
+            Object *object = objectsInScene[i];
+            if (object->object_type != type)
+            {
+                continue;
+            }
+            bake_object(object_memory_start, object, (int32_t)i + 1);
+            object_memory_start += 28;
+            (type == 0 ? baked.sphereCount : baked.planeCount)++;
         }
 
-        // Material color
-        _mm_store_ps(object_memory_start + 20, objectsInScene[i]->mat.color);
+        int32_t idOffset = (int32_t)objectsInScene.size();
+        for (size_t f = 0; f < files.size(); f++)
+        {
+            size_t count = load_baked_range(files[f], headers[f], type, object_memory_start, idOffset);
+            object_memory_start += 28 * count;
+            (type == 0 ? baked.sphereCount : baked.planeCount) += count;
+            idOffset += (int32_t)(headers[f].sphereCount + headers[f].planeCount);
+        }
+    }
 
-        // Material intensity
-        std::memcpy(object_memory_start + 24, &(objectsInScene[i]->mat.intensity), 4);
+    baked.spheres = baked.memory;
+    baked.planes = baked.memory + 28 * baked.sphereCount;
 
-        // Material diffuse
-        std::memcpy(object_memory_start + 25, &(objectsInScene[i]->mat.diffuse), 4);
+    // Sphere blocks for the 8-wide kernels, ordered by the leaves of the sphere BVH
+    baked.sphereBlocks = nullptr;
+    baked.sphereOrder = nullptr;
+    baked.bvhNodes = nullptr;
+    baked.bvhLevels = nullptr;
+    build_sphere_bvh(baked);
 
-        // Obj type
-        std::memcpy(object_memory_start + 26, &(objectsInScene[i]->object_type), 1);
+    // Light list: every emissive object (negative diffuse) can be sampled directly
+    baked.lightCount = 0;
+    // Baked files that could not be read leave fewer objects than allocated
+    objectCount = baked.sphereCount + baked.planeCount;
+    baked.lights = (const float **)malloc(sizeof(const float *) * std::max(objectCount, (size_t)1));
+    for (size_t i = 0; i < objectCount; i++)
+    {
+        const float *object = baked.memory + 28 * i;
+        if (object[25] < 0)
+        {
+            baked.lights[baked.lightCount++] = object;
+        }
     }
-    return memory_start;
-}
\ No newline at end of file
+
+    return baked;
+}
+
+/// @brief Frees all memory owned by a baked scene
+inline void free_baked_scene(BakedScene &baked)
+{
+    free_aligned(baked.memory);
+    free_aligned(baked.sphereBlocks);
+    free_aligned(baked.sphereOrder);
+    free_aligned(baked.bvhNodes);
+    free(baked.bvhLevels);
+    free(baked.lights);
+    baked.memory = nullptr;
+    baked.sphereBlocks = nullptr;
+    baked.sphereOrder = nullptr;
+    baked.bvhNodes = nullptr;
+    baked.bvhLevels = nullptr;
+    baked.lights = nullptr;
+}
@@ -1,6 +1,7 @@
 #include <vector>
 #include <iostream>
 #include <cstring>
+#include <cstdint>
 
 #include <immintrin.h>
 
@@ -111,86 +112,44 @@ public:
     }
 };
 
-Collision MemoryCollision(LightRay &ray, const float *objectMemStart)
+/// @brief Node of the sphere bounding volume hierarchy, 32 bytes. Inner nodes have count 0 and their children
+/// at first and first + 1, leaves hold count sphere blocks starting at block first
+struct BvhNode
 {
-    __m128 position = _mm_load_ps(objectMemStart);
-    __m128 scale = _mm_load_ps(objectMemStart + 4);
-
-    if (*(char *)(objectMemStart + 26) == 0) // Sphere Collision
-    {
-        __m128 L = _mm_sub_ps(position, ray.origin);
-        float tca = dot(L, ray.direction);
-        float d2 = dot(L, L) - tca * tca;
-
-        float radius = getX(scale);
-        float radius2 = radius * radius;
-
-        if (d2 > radius2)
-        {
-            return NO_COLLISION;
-        }
-
-        float thc = sqrtf(radius2 - d2);
-        float t0 = tca - thc;
-        float t1 = tca + thc;
-
-        if (t0 > t1)
-            std::swap(t0, t1);
-
-        if (t0 < 0)
-            t0 = t1;
-
-        if (t0 < 0 || t0 <= 0.001f)
-            return NO_COLLISION;
-
-        __m128 distv = _mm_set_ps1(t0);
-        __m128 point = _mm_fmadd_ps(ray.direction, distv, ray.origin);
-        __m128 normal = normalized(_mm_sub_ps(point, position));
-
-        return {true, point, normal, ray.direction, t0};
-    }
-
-    else // Plane Collision
-    {
-        __m128 normal = _mm_load_ps(objectMemStart + 8);
-        __m128 localX = _mm_load_ps(objectMemStart + 12);
-        __m128 localY = _mm_load_ps(objectMemStart + 16);
-
-        float divider = dot(ray.direction, normal);
-        if (abs(divider) <= 0.001)
-        {
-            return NO_COLLISION;
-        }
-
-        __m128 flippedNormal = flipped(normal);
-        if (divider > 0)
-        {
-            normal = flippedNormal;
-            divider *= -1;
-        }
-
-        float dist = dot(_mm_sub_ps(position, ray.origin), normal) / divider;
-        if (dist <= 0.001)
-        {
-            return NO_COLLISION;
-        }
-
-        __m128 distv = _mm_set_ps1(dist);
-        __m128 point = _mm_fmadd_ps(ray.direction, distv, ray.origin);
-        __m128 diff = _mm_sub_ps(point, position);
-
-        float y_dist = sqrt(norm2(cross(diff, localX)));
-        if (abs(y_dist) > getY(scale))
-        {
-            return NO_COLLISION;
-        }
-
-        float x_dist = sqrt(norm2(cross(diff, localY)));
-        if (abs(x_dist) > getX(scale))
-        {
-            return NO_COLLISION;
-        }
+    float min[3];
+    uint32_t first;
+    float max[3];
+    uint32_t count;
+};
 
-        return {true, point, normal, ray.direction, dist};
-    }
-}
\ No newline at end of file
+/// @brief Baked scene memory. Objects are grouped by type into contiguous ranges,
+/// so the render loop can run one specialized loop per object type without branching on the type byte.
+struct BakedScene
+{
+    /// @brief Start of memory block, owns all object ranges
+    float *memory;
+    /// @brief First baked sphere, spheres are stored first
+    float *spheres;
+    /// @brief First baked plane, stored directly after the spheres
+    float *planes;
+    size_t sphereCount;
+    size_t planeCount;
+    /// @brief Sphere centers and squared radii in blocks of 8 (x[8], y[8], z[8], r2[8]) for the 8-wide kernels.
+    /// Ordered by the BVH leaves, padding spheres have a negative squared radius and are never hit. 32 byte aligned
+    float *sphereBlocks;
+    size_t sphereBlockCount;
+    /// @brief Index in the sphere range of every block lane, BVH_PADDING for padding lanes
+    uint32_t *sphereOrder;
+    /// @brief Bounding volume hierarchy over the sphere blocks in breadth first order, the root is node 0.
+    /// No nodes without spheres
+    BvhNode *bvhNodes;
+    size_t bvhNodeCount;
+    /// @brief First node of every tree level and the node count at the end, bvhLevelCount + 1 entries
+    uint32_t *bvhLevels;
+    size_t bvhLevelCount;
+    /// @brief SAH cost of the tree after its last full build, refitted trees are compared with it
+    float bvhBuildCost;
+    /// @brief Emissive objects for next event estimation, pointers into the object ranges
+    const float **lights;
+    size_t lightCount;
+};
@@ -0,0 +1,168 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+
+#include <x86intrin.h>
+
+// Per pixel cost instrumentation, compiled in with the RAYTRACER_PROFILE option (CMakeLists.txt).
+// Without it every macro below is empty and the render loops are unchanged.
+
+/// @brief Pixels per tile side of the CSV summary
+const int PROFILE_TILE_SIZE = 16;
+
+/// @brief Work counters of one thread, only ever incremented by their own thread
+struct ProfileCounters
+{
+    uint64_t rays = 0;
+    /// @brief Ray-object tests, every SIMD lane counts as one test
+    uint64_t intersectionTests = 0;
+};
+
+inline thread_local ProfileCounters profileCounters;
+
+/// @brief Cycles, rays and intersection tests of every pixel, summed over all its samples
+class PixelProfile
+{
+public:
+    /// @brief State of the counters when a pixel starts
+    struct Mark
+    {
+        uint64_t tsc;
+        uint64_t rays;
+        uint64_t intersectionTests;
+    };
+
+    int width = 0;
+    int height = 0;
+    std::vector<uint64_t> cycles;
+    std::vector<uint64_t> rays;
+    std::vector<uint64_t> intersectionTests;
+
+    /// @brief Clears the profile for a new render
+    void Reset(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+        cycles.assign((size_t)width * height, 0);
+        rays.assign((size_t)width * height, 0);
+        intersectionTests.assign((size_t)width * height, 0);
+    }
+
+    static inline Mark Begin()
+    {
+        return {__rdtsc(), profileCounters.rays, profileCounters.intersectionTests};
+    }
+
+    /// @brief Adds the work since the mark to a pixel. A pixel is only worked on by one thread at a time
+    inline void End(const Mark &mark, int pixel)
+    {
+        cycles[pixel] += __rdtsc() - mark.tsc;
+        rays[pixel] += profileCounters.rays - mark.rays;
+        intersectionTests[pixel] += profileCounters.intersectionTests - mark.intersectionTests;
+    }
+
+    /// @brief Writes the cycle heatmap (<output>_heatmap.ppm) and the per tile summary (<output>_profile.csv) and prints totals
+    /// @param outputPath Path of the rendered image, the profile files are written next to it
+    void Write(const std::string &outputPath) const
+    {
+        std::string base = outputPath.substr(0, outputPath.find_last_of('.'));
+        WriteHeatmap(base + "_heatmap.ppm");
+        WriteSummary(base + "_profile.csv");
+    }
+
+private:
+    /// @brief Cycles mapped through a black - purple - red - yellow - white ramp. The scale ends at the 99th percentile,
+    /// so a few extreme pixels do not make everything else black
+    void WriteHeatmap(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file.is_open())
+        {
+            std::cerr << "PROFILE ERROR: UNABLE TO WRITE HEATMAP" << std::endl;
+            return;
+        }
+
+        std::vector<uint64_t> sorted = cycles;
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() * 99 / 100, sorted.end());
+        double scale = 1.0 / std::max(sorted[sorted.size() * 99 / 100], (uint64_t)1);
+
+        const float ramp[5][3] = {{0, 0, 0}, {0.4f, 0, 0.6f}, {0.9f, 0.2f, 0.1f}, {1, 0.8f, 0}, {1, 1, 1}};
+        file << "P3 " << width << " " << height << " 255\n";
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                float t = (float)std::min(cycles[y * width + x] * scale, 1.0) * 4;
+                int i = std::min((int)t, 3);
+                float f = t - i;
+                for (int c = 0; c < 3; c++)
+                {
+                    file << (int)(255 * (ramp[i][c] + (ramp[i + 1][c] - ramp[i][c]) * f)) << " ";
+                }
+            }
+            file << "\n";
+        }
+    }
+
+    /// @brief One line per tile, plus totals and the load imbalance on the console
+    void WriteSummary(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file.is_open())
+        {
+            std::cerr << "PROFILE ERROR: UNABLE TO WRITE SUMMARY" << std::endl;
+            return;
+        }
+
+        file << "tile_x,tile_y,pixels,cycles,rays,intersection_tests,cycles_per_ray\n";
+        uint64_t totalCycles = 0, totalRays = 0, totalTests = 0, maxTileCycles = 0;
+        int tiles = 0;
+        for (int ty = 0; ty < height; ty += PROFILE_TILE_SIZE)
+        {
+            for (int tx = 0; tx < width; tx += PROFILE_TILE_SIZE)
+            {
+                uint64_t tileCycles = 0, tileRays = 0, tileTests = 0;
+                int pixels = 0;
+                for (int y = ty; y < std::min(ty + PROFILE_TILE_SIZE, height); y++)
+                {
+                    for (int x = tx; x < std::min(tx + PROFILE_TILE_SIZE, width); x++)
+                    {
+                        tileCycles += cycles[y * width + x];
+                        tileRays += rays[y * width + x];
+                        tileTests += intersectionTests[y * width + x];
+                        pixels++;
+                    }
+                }
+                file << tx / PROFILE_TILE_SIZE << "," << ty / PROFILE_TILE_SIZE << "," << pixels << "," << tileCycles << ","
+                     << tileRays << "," << tileTests << "," << (double)tileCycles / std::max(tileRays, (uint64_t)1) << "\n";
+                totalCycles += tileCycles;
+                totalRays += tileRays;
+                totalTests += tileTests;
+                maxTileCycles = std::max(maxTileCycles, tileCycles);
+                tiles++;
+            }
+        }
+
+        std::cout << "Profile: " << totalCycles << " cycles, " << totalRays << " rays, " << totalTests << " intersection tests, "
+                  << (double)totalCycles / std::max(totalRays, (uint64_t)1) << " cycles per ray" << std::endl;
+        std::cout << "Profile: most expensive tile costs " << (double)maxTileCycles * tiles / std::max(totalCycles, (uint64_t)1)
+                  << "x the mean tile" << std::endl;
+    }
+};
+
+#ifdef RAYTRACER_PROFILE
+/// @brief Profile of the current render
+inline PixelProfile pixelProfile;
+
+#define PROFILE_ADD(counter, n) (profileCounters.counter += (n))
+#define PROFILE_PIXEL_BEGIN(mark) const PixelProfile::Mark mark = PixelProfile::Begin()
+#define PROFILE_PIXEL_END(mark, pixel) pixelProfile.End(mark, pixel)
+#else
+#define PROFILE_ADD(counter, n) ((void)0)
+#define PROFILE_PIXEL_BEGIN(mark) ((void)0)
+#define PROFILE_PIXEL_END(mark, pixel) ((void)0)
+#endif
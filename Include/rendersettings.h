@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <climits>
 
 class RenderSettings
 {
@@ -152,6 +153,256 @@ private:
         }
     }
 
+    void SetAdaptive(std::map<std::string, std::string> xml_params)
+    {
+        adaptive = true;
+        adaptive_min_samples = 8;
+        adaptive_max_samples = 256;
+        adaptive_error = 0.02f;
+        adaptive_seconds = 0;
+        sample_map_path = "";
+        for (const auto &[key, value] : xml_params)
+        {
+            if (key == "minSamples")
+            {
+                adaptive_min_samples = stoi(value);
+            }
+            else if (key == "maxSamples")
+            {
+                adaptive_max_samples = stoi(value);
+            }
+            else if (key == "error")
+            {
+                adaptive_error = stof(value);
+            }
+            else if (key == "seconds")
+            {
+                adaptive_seconds = stof(value);
+            }
+            else if (key == "samplemap")
+            {
+                sample_map_path = value;
+            }
+            else
+            {
+                std::cerr << "RENDERSETTINGS ERROR: UNKNOWN ADAPTIVE PARAMETER" << std::endl;
+            }
+        }
+        if (adaptive_min_samples < 2 || adaptive_max_samples < adaptive_min_samples)
+        {
+            adaptive_min_samples = std::max(adaptive_min_samples, 2);
+            adaptive_max_samples = std::max(adaptive_max_samples, adaptive_min_samples);
+            std::cerr << "RENDERSETTINGS ERROR: ADAPTIVE NEEDS 2 <= MINSAMPLES <= MAXSAMPLES" << std::endl;
+        }
+    }
+
+    void SetProgressive(std::map<std::string, std::string> xml_params)
+    {
+        progressive = true;
+        progressive_passes = 64;
+        preview_passes = 0;
+        preview_seconds = 0;
+        checkpoint_path = "";
+        for (const auto &[key, value] : xml_params)
+        {
+            if (key == "passes")
+            {
+                progressive_passes = stoi(value);
+            }
+            else if (key == "preview")
+            {
+                preview_passes = stoi(value);
+            }
+            else if (key == "previewSeconds")
+            {
+                preview_seconds = stof(value);
+            }
+            else if (key == "checkpoint")
+            {
+                checkpoint_path = value;
+            }
+            else
+            {
+                std::cerr << "RENDERSETTINGS ERROR: UNKNOWN PROGRESSIVE PARAMETER" << std::endl;
+            }
+        }
+        if (progressive_passes < 1)
+        {
+            progressive_passes = 1;
+            std::cerr << "RENDERSETTINGS ERROR: PROGRESSIVE NEEDS AT LEAST ONE PASS" << std::endl;
+        }
+    }
+
+    void SetBudget(std::map<std::string, std::string> xml_params)
+    {
+        budget_seconds = 0;
+        for (const auto &[key, value] : xml_params)
+        {
+            if (key == "seconds")
+            {
+                budget_seconds = stof(value);
+            }
+            else
+            {
+                std::cerr << "RENDERSETTINGS ERROR: UNKNOWN BUDGET PARAMETER" << std::endl;
+            }
+        }
+        if (budget_seconds <= 0)
+        {
+            std::cerr << "RENDERSETTINGS ERROR: MISSING BUDGET PARAMETER SECONDS" << std::endl;
+        }
+    }
+
+    void SetDenoise(std::map<std::string, std::string> xml_params)
+    {
+        denoise = true;
+        denoise_iterations = 5;
+        denoise_sigma_color = 0.5f;
+        denoise_sigma_normal = 0.3f;
+        denoise_sigma_depth = 0.02f;
+        for (const auto &[key, value] : xml_params)
+        {
+            if (key == "iterations")
+            {
+                denoise_iterations = stoi(value);
+            }
+            else if (key == "color")
+            {
+                denoise_sigma_color = stof(value);
+            }
+            else if (key == "normal")
+            {
+                denoise_sigma_normal = stof(value);
+            }
+            else if (key == "depth")
+            {
+                denoise_sigma_depth = stof(value);
+            }
+            else
+            {
+                std::cerr << "RENDERSETTINGS ERROR: UNKNOWN DENOISE PARAMETER" << std::endl;
+            }
+        }
+        if (denoise_iterations < 1 || denoise_sigma_color <= 0 || denoise_sigma_normal <= 0 || denoise_sigma_depth <= 0)
+        {
+            denoise = false;
+            std::cerr << "RENDERSETTINGS ERROR: DENOISE NEEDS AT LEAST ONE ITERATION AND POSITIVE SIGMAS, DENOISER DISABLED" << std::endl;
+        }
+    }
+
+    void SetAov(std::map<std::string, std::string> xml_params)
+    {
+        for (const auto &[key, value] : xml_params)
+        {
+            if (key == "depth")
+            {
+                aov_depth_path = value;
+            }
+            else if (key == "normal")
+            {
+                aov_normal_path = value;
+            }
+            else if (key == "albedo")
+            {
+                aov_albedo_path = value;
+            }
+            else if (key == "objectid")
+            {
+                aov_objectid_path = value;
+            }
+            else if (key == "samples")
+            {
+                aov_samples_path = value;
+            }
+            else if (key == "time")
+            {
+                aov_time_path = value;
+            }
+            else
+            {
+                std::cerr << "RENDERSETTINGS ERROR: UNKNOWN AOV PARAMETER" << std::endl;
+            }
+        }
+    }
+
+    void SetStatistics(std::map<std::string, std::string> xml_params)
+    {
+        for (const auto &[key, value] : xml_params)
+        {
+            if (key == "json")
+            {
+                stats_json_path = value;
+            }
+            else
+            {
+                std::cerr << "RENDERSETTINGS ERROR: UNKNOWN STATISTICS PARAMETER" << std::endl;
+            }
+        }
+    }
+
+    void SetTrace(std::map<std::string, std::string> xml_params)
+    {
+        for (const auto &[key, value] : xml_params)
+        {
+            if (key == "path")
+            {
+                trace_path = value;
+            }
+            else
+            {
+                std::cerr << "RENDERSETTINGS ERROR: UNKNOWN TRACE PARAMETER" << std::endl;
+            }
+        }
+    }
+
+    void SetVideo(std::map<std::string, std::string> xml_params)
+    {
+        for (const auto &[key, value] : xml_params)
+        {
+            if (key == "pipe")
+            {
+                video_pipe = value;
+            }
+            else if (key == "command")
+            {
+                video_command = value;
+            }
+            else if (key == "fps")
+            {
+                video_fps = std::stoi(value);
+            }
+            else
+            {
+                std::cerr << "RENDERSETTINGS ERROR: UNKNOWN VIDEO PARAMETER" << std::endl;
+            }
+        }
+        if (!video_pipe.empty() && !video_command.empty())
+        {
+            video_pipe = "";
+            std::cerr << "RENDERSETTINGS ERROR: VIDEO PIPE AND COMMAND CAN NOT BE COMBINED, USING COMMAND" << std::endl;
+        }
+    }
+
+    void SetBvh(std::map<std::string, std::string> xml_params)
+    {
+        for (const auto &[key, value] : xml_params)
+        {
+            if (key == "rebuild")
+            {
+                bvh_rebuild_ratio = std::stof(value);
+                if (bvh_rebuild_ratio < 1)
+                {
+                    bvh_rebuild_ratio = 1;
+                    std::cerr << "RENDERSETTINGS ERROR: BVH REBUILD RATIO MUST BE AT LEAST 1" << std::endl;
+                }
+            }
+            else
+            {
+                std::cerr << "RENDERSETTINGS ERROR: UNKNOWN BVH PARAMETER" << std::endl;
+            }
+        }
+    }
+
 public:
     /// @brief Width, Height
     std::vector<int> resolution;
@@ -164,6 +415,63 @@ public:
 
     /// @brief How many bits to use for one RGB channel
     int channel_depth;
+
+    /// @brief Adaptive sampling: samples per pixel until its error is small enough, replaces the supersampling grid
+    bool adaptive = false;
+    /// @brief Samples every pixel gets before its error is estimated
+    int adaptive_min_samples = 8;
+    int adaptive_max_samples = 256;
+    /// @brief Target standard error of a pixel, relative to its brightness
+    float adaptive_error = 0.02f;
+    /// @brief Time limit for sampling in seconds, 0 for none
+    float adaptive_seconds = 0;
+    /// @brief Output path of the samples per pixel debug image, empty for none
+    std::string sample_map_path;
+
+    /// @brief Progressive rendering: one sample per pixel and pass, accumulated over all passes
+    bool progressive = false;
+    int progressive_passes = 64;
+    /// @brief Write a preview image every n passes, 0 for none
+    int preview_passes = 0;
+    /// @brief Write a preview image every n seconds, 0 for none
+    float preview_seconds = 0;
+    /// @brief Accumulation buffer file, saved with every preview and resumed from at start. Empty for none
+    std::string checkpoint_path;
+
+    /// @brief Time budget for the whole render in seconds, 0 for none. Runs progressive passes until the budget is used up
+    float budget_seconds = 0;
+
+    /// @brief Feature guided denoiser (a-trous wavelet filter) on the final image
+    bool denoise = false;
+    /// @brief Filter iterations, the filter covers 2^(iterations + 2) - 3 pixels
+    int denoise_iterations = 5;
+    /// @brief Color difference at which neighbours stop contributing, larger values smooth more
+    float denoise_sigma_color = 0.5f;
+    /// @brief Normal difference at which neighbours stop contributing
+    float denoise_sigma_normal = 0.3f;
+    /// @brief Relative depth difference at which neighbours stop contributing
+    float denoise_sigma_depth = 0.02f;
+
+    /// @brief Output paths of the auxiliary buffers (.pfm), written in the same pass as the image. Empty for none
+    std::string aov_depth_path;
+    std::string aov_normal_path;
+    std::string aov_albedo_path;
+    std::string aov_objectid_path;
+    std::string aov_samples_path;
+    std::string aov_time_path;
+
+    /// @brief Output path of the render statistics as JSON, empty for none. The statistics are always printed
+    std::string stats_json_path;
+    /// @brief Output path of the phase and tile timings as Chrome trace JSON, empty for none
+    std::string trace_path;
+    /// @brief Raw video output instead of image files: "-" for stdout, otherwise a file or named pipe. Empty for none
+    std::string video_pipe;
+    /// @brief Encoder command that gets the raw frames on stdin, {width}, {height}, {format} and {fps} are filled in. Empty for none
+    std::string video_command;
+    /// @brief Frame rate passed to the encoder command
+    int video_fps = 30;
+    /// @brief Animations refit the sphere BVH every frame and rebuild it once its SAH cost grew by this factor since the last build
+    float bvh_rebuild_ratio = 1.5f;
     /// @brief Default render settings: FullHD, 8bit depth
     RenderSettings() // Default settings
     {
@@ -226,10 +534,89 @@ public:
             {
                 SetScatter(current_setting.parameters);
             }
+            else if (current_setting.tag_name == "adaptive")
+            {
+                SetAdaptive(current_setting.parameters);
+            }
+            else if (current_setting.tag_name == "progressive")
+            {
+                SetProgressive(current_setting.parameters);
+            }
+            else if (current_setting.tag_name == "budget")
+            {
+                SetBudget(current_setting.parameters);
+            }
+            else if (current_setting.tag_name == "denoise")
+            {
+                SetDenoise(current_setting.parameters);
+            }
+            else if (current_setting.tag_name == "aov")
+            {
+                SetAov(current_setting.parameters);
+            }
+            else if (current_setting.tag_name == "statistics")
+            {
+                SetStatistics(current_setting.parameters);
+            }
+            else if (current_setting.tag_name == "trace")
+            {
+                SetTrace(current_setting.parameters);
+            }
+            else if (current_setting.tag_name == "video")
+            {
+                SetVideo(current_setting.parameters);
+            }
+            else if (current_setting.tag_name == "bvh")
+            {
+                SetBvh(current_setting.parameters);
+            }
             else
             {
                 std::cerr << "RENDERSETTINGS ERROR: UNKNOWN TAG " << current_setting.tag_name << std::endl;
             }
         }
+        if (budget_seconds > 0 && !progressive)
+        {
+            // Budget without pass limit: passes until the time is up
+            progressive = true;
+            progressive_passes = INT_MAX;
+        }
+        if (progressive && adaptive)
+        {
+            adaptive = false;
+            std::cerr << "RENDERSETTINGS ERROR: PROGRESSIVE AND ADAPTIVE CAN NOT BE COMBINED, USING PROGRESSIVE" << std::endl;
+        }
+    }
+
+    /// @brief Inserts the frame number before the extension: render.ppm becomes render_0007.ppm. Empty paths stay empty
+    static std::string FramePath(const std::string &path, int frame)
+    {
+        if (path.empty())
+        {
+            return path;
+        }
+        char number[16];
+        std::snprintf(number, sizeof(number), "_%04d", frame);
+        size_t extension = path.find_last_of('.');
+        size_t separator = path.find_last_of("/\\");
+        if (extension == std::string::npos || (separator != std::string::npos && extension < separator))
+        {
+            return path + number;
+        }
+        return path.substr(0, extension) + number + path.substr(extension);
+    }
+
+    /// @brief Settings of one animation frame: every per image output gets the frame number, the trace covers all frames
+    RenderSettings ForFrame(int frame) const
+    {
+        RenderSettings settings = *this;
+        for (std::string *path : {&settings.output_path, &settings.sample_map_path, &settings.checkpoint_path,
+                                  &settings.aov_depth_path, &settings.aov_normal_path, &settings.aov_albedo_path,
+                                  &settings.aov_objectid_path, &settings.aov_samples_path, &settings.aov_time_path,
+                                  &settings.stats_json_path})
+        {
+            *path = FramePath(*path, frame);
+        }
+        return settings;
     }
 };
@@ -1,6 +1,16 @@
+#pragma once
 #include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <cmath>
+#include <algorithm>
 
-std::string generate_PPM_header(RenderSettings rs)
+#include <immintrin.h>
+
+inline std::string generate_PPM_header(RenderSettings rs)
 {
     // https://de.wikipedia.org/wiki/Portable_Anymap#Kopfdaten
 
@@ -9,4 +19,159 @@ std::string generate_PPM_header(RenderSettings rs)
     header += std::to_string(rs.resolution[1]) + " ";       // Define height
     header += std::to_string(1 << rs.channel_depth) + "\n"; // Define color depth - 1<<x = 2^x
     return header;
-}
\ No newline at end of file
+}
+
+/// @brief Writes a grayscale image of the samples each pixel received, white is maxSamples
+/// @param samples Row major sample counts
+inline void write_sample_map(const std::string &path, const int *samples, int width, int height, int maxSamples)
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "RENDER ERROR: UNABLE TO WRITE SAMPLE MAP" << std::endl;
+        return;
+    }
+
+    file << "P2 " << width << " " << height << " 255\n";
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            file << std::min(samples[y * width + x] * 255 / maxSamples, 255) << " ";
+        }
+        file << "\n";
+    }
+}
+
+/// @brief Whether adaptive sampling is done with a pixel: its sample limit is reached,
+/// or the standard error of its mean luminance is below the target
+/// @param luminanceSum Sum of the luminance of all samples
+/// @param luminanceSquares Sum of the squared luminance of all samples
+/// @param samples Samples taken so far, at least 2
+/// @param targetError Relative error target, adaptive_error of the settings
+inline bool adaptive_converged(float luminanceSum, float luminanceSquares, int samples, int maxSamples, float targetError)
+{
+    if (samples >= maxSamples)
+    {
+        return true;
+    }
+    float n = (float)samples;
+    float mean = luminanceSum / n;
+    float variance = std::max(luminanceSquares / n - mean * mean, 0.0f) * n / (n - 1);
+    // Dark pixels are measured against a floor, they would never converge relative to their tiny mean
+    float error = std::sqrt(variance / n) / std::max(mean, 0.1f);
+    return error <= targetError;
+}
+
+/// @brief Writes a Portable Float Map, grayscale for 1 channel, RGB for 3. Rows are stored bottom to top, little endian
+/// @param values Row major, the channels of a pixel are the first floats of its stride
+/// @param channels 1 or 3
+/// @param stride Floats from one pixel to the next
+inline bool write_pfm(const std::string &path, const float *values, int channels, int stride, int width, int height)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "RENDER ERROR: UNABLE TO WRITE " << path << std::endl;
+        return false;
+    }
+
+    file << (channels == 3 ? "PF" : "Pf") << "\n"
+         << width << " " << height << "\n-1.0\n";
+    std::vector<float> row(width * channels);
+    for (int y = height - 1; y >= 0; y--)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            for (int c = 0; c < channels; c++)
+            {
+                row[x * channels + c] = values[((size_t)y * width + x) * stride + c];
+            }
+        }
+        file.write((const char *)row.data(), row.size() * sizeof(float));
+    }
+    return (bool)file;
+}
+
+/// @brief Identifies accumulation checkpoint files, version 2 stores the checkpoint key
+const uint32_t CHECKPOINT_MAGIC = 0x32415452; // "RTA2"
+
+/// @brief Key of the render a checkpoint belongs to: FNV-1a hash of the scene path and the settings that change the samples of a pass.
+/// Resolution is checked on its own, output settings (depth, smoothing, denoising, paths) may change between runs
+inline uint32_t checkpoint_key(const std::string &scenePath, const RenderSettings &settings)
+{
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](const void *data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ ((const uint8_t *)data)[i]) * 16777619u;
+        }
+    };
+    add(scenePath.data(), scenePath.size());
+    const int32_t sampling[3] = {settings.bounces, settings.scatterbase, settings.scatterredux};
+    add(sampling, sizeof(sampling));
+    return hash;
+}
+
+/// @brief Saves a progressive accumulation buffer. Written to a temporary file first and renamed,
+/// so a job killed while writing keeps the previous checkpoint
+/// @param accumulation Row major sum of all passes
+/// @param passes Passes summed in the buffer
+/// @param key checkpoint_key of the render
+inline bool save_checkpoint(const std::string &path, const __m128 *accumulation, int width, int height, int passes, uint32_t key)
+{
+    std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "RENDER ERROR: UNABLE TO WRITE CHECKPOINT" << std::endl;
+        return false;
+    }
+
+    int32_t header[5] = {(int32_t)CHECKPOINT_MAGIC, width, height, passes, (int32_t)key};
+    file.write((const char *)header, sizeof(header));
+    file.write((const char *)accumulation, (size_t)width * height * sizeof(__m128));
+    file.close();
+    if (!file || std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "RENDER ERROR: UNABLE TO WRITE CHECKPOINT" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/// @brief Loads a progressive accumulation buffer saved by save_checkpoint
+/// @param accumulation Receives the buffer, width * height entries
+/// @param passes Receives the passes summed in the buffer
+/// @param key checkpoint_key of the render
+/// @return false if there is no checkpoint or it belongs to a different resolution, scene or sampling settings
+inline bool load_checkpoint(const std::string &path, __m128 *accumulation, int width, int height, int &passes, uint32_t key)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    int32_t header[5];
+    file.read((char *)header, sizeof(header));
+    if (!file || (uint32_t)header[0] != CHECKPOINT_MAGIC || header[1] != width || header[2] != height)
+    {
+        std::cerr << "RENDER ERROR: CHECKPOINT DOES NOT MATCH THE RENDER SETTINGS, STARTING FROM SCRATCH" << std::endl;
+        return false;
+    }
+    if ((uint32_t)header[4] != key)
+    {
+        std::cerr << "RENDER ERROR: CHECKPOINT BELONGS TO A DIFFERENT SCENE OR SAMPLING SETTINGS, STARTING FROM SCRATCH" << std::endl;
+        return false;
+    }
+    file.read((char *)accumulation, (size_t)width * height * sizeof(__m128));
+    if (!file)
+    {
+        std::cerr << "RENDER ERROR: CHECKPOINT IS INCOMPLETE, STARTING FROM SCRATCH" << std::endl;
+        return false;
+    }
+    passes = header[3];
+    return true;
+}
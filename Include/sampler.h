@@ -0,0 +1,170 @@
+#pragma once
+#include <cstdint>
+
+#include <immintrin.h>
+#include <smmintrin.h>
+
+/// @brief Direction numbers of the first 4 Sobol dimensions, 32 bits each, lanes are dimensions
+struct SobolDirections
+{
+    alignas(16) uint32_t v[32][4];
+};
+
+/// @brief Builds the Sobol direction numbers at compile time. Dimension 1 is van der Corput,
+/// dimensions 2 to 4 use the primitive polynomials and initial numbers of Joe & Kuo
+constexpr SobolDirections MakeSobolDirections()
+{
+    SobolDirections directions{};
+    const uint32_t degree[3] = {1, 2, 3};
+    const uint32_t coefficients[3] = {0, 1, 1};
+    const uint32_t initial[3][3] = {{1, 0, 0}, {1, 3, 0}, {1, 3, 1}};
+
+    for (int k = 0; k < 32; k++)
+    {
+        directions.v[k][0] = 1u << (31 - k);
+    }
+    for (int d = 0; d < 3; d++)
+    {
+        const uint32_t s = degree[d];
+        uint32_t m[32] = {};
+        for (uint32_t k = 0; k < 32; k++)
+        {
+            if (k < s)
+            {
+                m[k] = initial[d][k];
+                continue;
+            }
+            m[k] = m[k - s] ^ (m[k - s] << s);
+            for (uint32_t i = 1; i < s; i++)
+            {
+                if ((coefficients[d] >> (s - 1 - i)) & 1)
+                {
+                    m[k] ^= m[k - i] << i;
+                }
+            }
+        }
+        for (int k = 0; k < 32; k++)
+        {
+            directions.v[k][d + 1] = m[k] << (31 - k);
+        }
+    }
+    return directions;
+}
+
+constexpr SobolDirections SOBOL_DIRECTIONS = MakeSobolDirections();
+
+/// @brief XOR of the direction numbers of every value of each byte of the index, a Sobol point takes 4 lookups instead of 32 steps
+struct SobolByteTables
+{
+    alignas(16) uint32_t v[4][256][4];
+};
+
+constexpr SobolByteTables MakeSobolByteTables()
+{
+    SobolByteTables tables{};
+    for (int byte = 0; byte < 4; byte++)
+    {
+        for (int value = 0; value < 256; value++)
+        {
+            for (int bit = 0; bit < 8; bit++)
+            {
+                if ((value >> bit) & 1)
+                {
+                    for (int d = 0; d < 4; d++)
+                    {
+                        tables.v[byte][value][d] ^= SOBOL_DIRECTIONS.v[8 * byte + bit][d];
+                    }
+                }
+            }
+        }
+    }
+    return tables;
+}
+
+constexpr SobolByteTables SOBOL_BYTE_TABLES = MakeSobolByteTables();
+
+/// @brief Low discrepancy sampler for one pixel. Every call of Next returns the next group of 4 dimensions of the current sample.
+/// Each group draws its point from the 4 dimensional Sobol sequence at an own Owen scrambled (nested uniform shuffled) sample index,
+/// so the groups of one sample are independent points instead of copies of the same point. The shuffle maps every aligned block
+/// of 2^m indices onto an aligned block, the first 2^m samples of a pixel stay stratified in every group.
+/// A Cranley-Patterson rotation per pixel and group decorrelates neighbouring pixels
+class Sampler
+{
+private:
+    uint32_t sampleIndex = 0;
+    uint32_t pixelHash;
+    uint32_t dimension = 0;
+
+    /// @brief Integer hash (lowbias32) of 4 lanes at once
+    static inline __m128i Hash(__m128i x)
+    {
+        x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+        x = _mm_mullo_epi32(x, _mm_set1_epi32(0x7feb352d));
+        x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+        x = _mm_mullo_epi32(x, _mm_set1_epi32((int)0x846ca68b));
+        x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+        return x;
+    }
+
+    static inline uint32_t ReverseBits(uint32_t x)
+    {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    /// @brief Owen scrambling of the index bits (Laine-Karras hash on the reversed bits, Burley 2020).
+    /// Every bit is flipped depending only on the seed and the bits above it
+    static inline uint32_t ShuffleIndex(uint32_t index, uint32_t seed)
+    {
+        uint32_t x = ReverseBits(index);
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return ReverseBits(x);
+    }
+
+    /// @brief Sobol point of an index in 0.32 fixed point, all 4 dimensions at once
+    static inline __m128i SobolPoint(uint32_t index)
+    {
+        __m128i point = _mm_load_si128((const __m128i *)SOBOL_BYTE_TABLES.v[0][index & 0xff]);
+        point = _mm_xor_si128(point, _mm_load_si128((const __m128i *)SOBOL_BYTE_TABLES.v[1][(index >> 8) & 0xff]));
+        point = _mm_xor_si128(point, _mm_load_si128((const __m128i *)SOBOL_BYTE_TABLES.v[2][(index >> 16) & 0xff]));
+        return _mm_xor_si128(point, _mm_load_si128((const __m128i *)SOBOL_BYTE_TABLES.v[3][index >> 24]));
+    }
+
+public:
+    /// @param x Pixel x
+    /// @param y Pixel y
+    /// @param seed Different seeds give independent rotations, e.g. per frame
+    Sampler(int x, int y, uint32_t seed = 0)
+    {
+        pixelHash = (uint32_t)_mm_cvtsi128_si32(Hash(_mm_set1_epi32((int)((uint32_t)x * 0x8da6b343u ^ (uint32_t)y * 0xd8163841u ^ seed * 0xcb1ab31fu))));
+        StartSample(0);
+    }
+
+    /// @brief Starts sample index of the pixel, dimensions start again at 0
+    inline void StartSample(uint32_t index)
+    {
+        sampleIndex = index;
+        dimension = 0;
+    }
+
+    /// @brief Next 4 dimensions of the current sample
+    /// @return Uniform values in [0, 1)
+    inline __m128 Next()
+    {
+        const uint32_t groupSeed = pixelHash + dimension * 0x9e3779b9u;
+        const __m128i point = SobolPoint(ShuffleIndex(sampleIndex, groupSeed));
+        // Rotation by a random offset, the integer add wraps around like a rotation on the unit torus
+        __m128i lanes = _mm_add_epi32(_mm_set1_epi32((int)(groupSeed ^ 0x5bd1e995u)), _mm_setr_epi32(0, 1, 2, 3));
+        __m128i rotated = _mm_add_epi32(point, Hash(lanes));
+        dimension++;
+        // Top 24 bits convert exactly to float
+        return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(rotated, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+    }
+};
@@ -13,6 +13,8 @@ private:
     /// @return Scene object
     void parseFromFile(std::string path_to_file)
     {
+        size_t separator = path_to_file.find_last_of("/\\");
+        directory = separator == std::string::npos ? "" : path_to_file.substr(0, separator + 1);
         std::string content = removeComments(readFile(path_to_file));
         XML_Node scene_root = parse_xml_bracket(content);
         if (scene_root.tag_name != "scene")
@@ -21,6 +23,8 @@ private:
         }
         bool defined_objects = false;
         bool defined_camera = false;
+        // The camera keeps a copy of the scene, so it is created after everything else is parsed
+        XML_Node camera_node("", {}, {});
         for (std::string scene : scene_root.children)
         {
             XML_Node current_scene = parse_xml_bracket(scene);
@@ -31,18 +35,26 @@ private:
             }
             else if (current_scene.tag_name == "camera")
             {
-                ParseCamera(current_scene.parameters);
+                camera_node = current_scene;
                 defined_camera = true;
             }
             else if (current_scene.tag_name == "materials")
             {
                 ParseMaterials(current_scene.children);
             }
+            else if (current_scene.tag_name == "animation")
+            {
+                ParseAnimation(current_scene.parameters, current_scene.children);
+            }
             else
             {
                 std::cerr << "SCENE ERROR: UNKNOWN TAG " << current_scene.tag_name << std::endl;
             }
         }
+        if (defined_camera)
+        {
+            ParseCamera(camera_node.parameters, camera_node.children);
+        }
         if (!defined_camera || !defined_objects)
         {
             std::cerr << "SCENE ERROR: EITHER NO CAMERA OR NO OBJECTS DEFINED!" << std::endl;
@@ -62,6 +74,10 @@ private:
             {
                 CreatePlane(current_object.parameters);
             }
+            else if (current_object.tag_name == "Baked")
+            {
+                AddBakedFile(current_object.parameters);
+            }
             else
             {
                 std::cerr << "SCENE ERROR: UNKNOWN OBJECT TYPE " << current_object.tag_name << std::endl;
@@ -69,7 +85,66 @@ private:
         }
     }
 
-    void ParseCamera(std::map<std::string, std::string> sphereParams);
+    /// @brief <animation frames="48" stream="transforms.txt">: renders one image per frame. Keyframes are given as
+    /// <keyframe object="1" frame="0" position="0, 1, 0" /> children or in the stream file, see Animation::LoadStream.
+    /// Relative stream paths start at the folder of the scene file
+    void ParseAnimation(std::map<std::string, std::string> animationParams, std::vector<string> keyframeStrings)
+    {
+        for (const auto &[key, value] : animationParams)
+        {
+            if (key == "frames")
+            {
+                animation.SetFrames(std::stoi(value));
+            }
+            else if (key == "stream")
+            {
+                bool absolute = !value.empty() && (value[0] == '/' || value[0] == '\\' || value.find(':') != std::string::npos);
+                std::string path = absolute ? value : directory + value;
+                if (!animation.LoadStream(path))
+                {
+                    std::cerr << "SCENE ERROR: UNABLE TO READ TRANSFORM STREAM " << path << std::endl;
+                }
+            }
+            else
+            {
+                std::cerr << "SCENE ERROR: UNKNOWN ANIMATION PARAMETER " << key << std::endl;
+            }
+        }
+        for (std::string keyframeString : keyframeStrings)
+        {
+            XML_Node keyframe = parse_xml_bracket(keyframeString);
+            if (keyframe.tag_name != "keyframe")
+            {
+                std::cerr << "SCENE ERROR: UNKNOWN ANIMATION TAG " << keyframe.tag_name << std::endl;
+                continue;
+            }
+            int32_t objectId = 0;
+            int frame = 0;
+            Vec3 position;
+            for (const auto &[key, value] : keyframe.parameters)
+            {
+                if (key == "object")
+                {
+                    objectId = std::stoi(value);
+                }
+                else if (key == "frame")
+                {
+                    frame = std::stoi(value);
+                }
+                else if (key == "position")
+                {
+                    position = parseVec3(value);
+                }
+                else
+                {
+                    std::cerr << "SCENE ERROR: UNKNOWN KEYFRAME PARAMETER " << key << std::endl;
+                }
+            }
+            animation.AddKeyframe(objectId, frame, position.data);
+        }
+    }
+
+    void ParseCamera(std::map<std::string, std::string> camParams, std::vector<string> gradientStrings);
 
     void ParseMaterials(std::vector<string> materialsStrings)
     {
@@ -141,6 +216,24 @@ private:
         this->objects.push_back(new Sphere(position, radius, material));
     }
 
+    /// @brief <Baked path="objects.baked" />: binary object file of the scenegen tool, loaded directly into the baked memory.
+    /// Relative paths start at the folder of the scene file
+    void AddBakedFile(std::map<std::string, std::string> bakedParams)
+    {
+        for (const auto &[key, value] : bakedParams)
+        {
+            if (key == "path")
+            {
+                bool absolute = !value.empty() && (value[0] == '/' || value[0] == '\\' || value.find(':') != std::string::npos);
+                bakedFiles.push_back(absolute ? value : directory + value);
+            }
+            else
+            {
+                std::cerr << "SCENE ERROR: UNKNOWN BAKED PARAMETER " << key << std::endl;
+            }
+        }
+    }
+
     void CreatePlane(std::map<std::string, std::string> planeParams)
     {
         Vec3 position;
@@ -194,9 +287,18 @@ private:
         return Material("MISSING", Vec3(0, 0, 0), 0, 0);
     }
 
+    /// @brief Folder of the scene file, ends with a separator. Empty for the working directory
+    std::string directory;
+
 public:
+    /// @brief Path of the .scene file as given on the command line
+    std::string path;
     std::vector<Object *> objects;
+    /// @brief Binary baked object files, see bake_into_memory
+    std::vector<std::string> bakedFiles;
     std::vector<Material> materials;
+    /// @brief Object movement, inactive for still images
+    Animation animation;
     Camera *cam;
     RenderSettings rs;
 
@@ -205,6 +307,7 @@ public:
     Scene(std::string path_to_file, RenderSettings rs)
     {
         this->rs = rs;
+        path = path_to_file;
         parseFromFile(path_to_file);
         std::cout << "Parsed " << objects.size() << " objects and " << materials.size() << " materials." << std::endl;
     }
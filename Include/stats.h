@@ -0,0 +1,166 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+/// @brief Deepest bounce the histogram resolves, deeper paths are counted in the last bin
+const int STATS_MAX_DEPTH = 15;
+
+/// @brief Throughput counters of a render. One instance per thread, summed after the render
+struct alignas(64) RenderStats
+{
+    /// @brief Camera rays
+    uint64_t primaryRays;
+    /// @brief Reflected and scattered rays
+    uint64_t secondaryRays;
+    /// @brief Occlusion rays of the direct light sampling
+    uint64_t shadowRays;
+    uint64_t collisionCalls;
+    uint64_t occlusionCalls;
+    /// @brief Paths ending at each depth: on a miss, on a light or at the bounce limit. Every scatter ray continues its own path
+    uint64_t depthHistogram[STATS_MAX_DEPTH + 1];
+
+    void Clear() { std::memset((void *)this, 0, sizeof(RenderStats)); }
+
+    void Add(const RenderStats &other)
+    {
+        primaryRays += other.primaryRays;
+        secondaryRays += other.secondaryRays;
+        shadowRays += other.shadowRays;
+        collisionCalls += other.collisionCalls;
+        occlusionCalls += other.occlusionCalls;
+        for (int d = 0; d <= STATS_MAX_DEPTH; d++)
+        {
+            depthHistogram[d] += other.depthHistogram[d];
+        }
+    }
+
+    inline void EndPath(int depth)
+    {
+        depthHistogram[depth < 0 ? 0 : (depth > STATS_MAX_DEPTH ? STATS_MAX_DEPTH : depth)]++;
+    }
+
+    uint64_t Paths() const
+    {
+        uint64_t paths = 0;
+        for (int d = 0; d <= STATS_MAX_DEPTH; d++)
+        {
+            paths += depthHistogram[d];
+        }
+        return paths;
+    }
+
+    double AverageBounces() const
+    {
+        uint64_t bounces = 0;
+        for (int d = 0; d <= STATS_MAX_DEPTH; d++)
+        {
+            bounces += d * depthHistogram[d];
+        }
+        return (double)bounces / std::max(Paths(), (uint64_t)1);
+    }
+};
+
+/// @brief Owns the counters of every thread that ever counted something. The threads only write to their own counters,
+/// so the hot loops need no atomics. Only reset and summed while no render loop runs
+class StatsRegistry
+{
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<RenderStats>> threads;
+
+public:
+    /// @brief New zeroed counters for the calling thread, once per thread
+    RenderStats *Register()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(std::make_unique<RenderStats>());
+        threads.back()->Clear();
+        return threads.back().get();
+    }
+
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &stats : threads)
+        {
+            stats->Clear();
+        }
+    }
+
+    RenderStats Sum()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        RenderStats sum;
+        sum.Clear();
+        for (auto &stats : threads)
+        {
+            sum.Add(*stats);
+        }
+        return sum;
+    }
+};
+
+inline StatsRegistry statsRegistry;
+
+/// @brief Counters of the calling thread
+inline RenderStats &LocalStats()
+{
+    thread_local RenderStats *local = statsRegistry.Register();
+    return *local;
+}
+
+/// @brief Prints the throughput of a render and writes it as JSON if a path is given
+/// @param seconds Duration of the sampling phase
+/// @param jsonPath Output path, empty for none
+inline void report_render_stats(const RenderStats &stats, double seconds, const std::string &jsonPath)
+{
+    uint64_t rays = stats.primaryRays + stats.secondaryRays + stats.shadowRays;
+    double raysPerSecond = seconds > 0 ? rays / seconds : 0;
+
+    std::cout << "Rays: " << stats.primaryRays << " primary, " << stats.secondaryRays << " secondary, " << stats.shadowRays << " shadow, "
+              << raysPerSecond / 1e6 << " Mrays/s" << std::endl;
+    std::cout << "Scene queries: " << stats.collisionCalls << " collision, " << stats.occlusionCalls << " occlusion" << std::endl;
+    std::cout << "Paths: " << stats.Paths() << ", average bounces " << stats.AverageBounces() << ", depth histogram";
+    for (int d = 0; d <= STATS_MAX_DEPTH; d++)
+    {
+        if (stats.depthHistogram[d] > 0)
+        {
+            std::cout << " " << d << ":" << stats.depthHistogram[d];
+        }
+    }
+    std::cout << std::endl;
+
+    if (jsonPath.empty())
+    {
+        return;
+    }
+    std::ofstream file(jsonPath);
+    if (!file.is_open())
+    {
+        std::cerr << "RENDER ERROR: UNABLE TO WRITE STATISTICS" << std::endl;
+        return;
+    }
+    file << "{\n"
+         << "  \"seconds\": " << seconds << ",\n"
+         << "  \"primary_rays\": " << stats.primaryRays << ",\n"
+         << "  \"secondary_rays\": " << stats.secondaryRays << ",\n"
+         << "  \"shadow_rays\": " << stats.shadowRays << ",\n"
+         << "  \"rays_per_second\": " << raysPerSecond << ",\n"
+         << "  \"collision_calls\": " << stats.collisionCalls << ",\n"
+         << "  \"occlusion_calls\": " << stats.occlusionCalls << ",\n"
+         << "  \"paths\": " << stats.Paths() << ",\n"
+         << "  \"average_bounces\": " << stats.AverageBounces() << ",\n"
+         << "  \"depth_histogram\": [";
+    for (int d = 0; d <= STATS_MAX_DEPTH; d++)
+    {
+        file << (d > 0 ? ", " : "") << stats.depthHistogram[d];
+    }
+    file << "]\n}\n";
+}
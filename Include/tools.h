@@ -7,6 +7,7 @@
 #include <random>
 #include <algorithm>
 #include <sstream>
+#include <cfloat>
 
 #include <xmmintrin.h> // Vector instrinsics
 #include <pmmintrin.h> // SSE3
@@ -371,6 +372,45 @@ inline __m128 get_gradient(__m128 *points, std::vector<float> &marks, float posi
     return _mm_setzero_ps();
 }
 
+/// @brief Number of interpolation intervals in the skybox lookup table
+const int SKYBOX_LUT_SIZE = 256;
+
+/// @brief Skybox gradient baked into a fixed size lookup table, indexed by the Y component of the ray direction.
+/// Replaces the linear search of get_gradient for every ray that misses
+struct alignas(16) SkyboxLUT
+{
+    /// @brief Last entry is duplicated, so interpolation never reads past the end
+    __m128 entries[SKYBOX_LUT_SIZE + 1];
+
+    /// @brief Samples the gradient once per table entry
+    /// @param points The colors inside the gradient
+    /// @param marks Sorted positions of the colors, see get_gradient
+    void Bake(__m128 *points, std::vector<float> &marks)
+    {
+        for (int i = 0; i < SKYBOX_LUT_SIZE; i++)
+        {
+            entries[i] = get_gradient(points, marks, (float)i / (SKYBOX_LUT_SIZE - 1));
+        }
+        entries[SKYBOX_LUT_SIZE] = entries[SKYBOX_LUT_SIZE - 1];
+    }
+
+    /// @brief Skybox color in the given direction
+    /// @param direction Normalized direction
+    inline __m128 Lookup(__m128 direction) const
+    {
+        // Gradient position (y * 0.5 + 0.5) scaled to the table, clamped so rounding errors stay inside
+        __m128 pos = _mm_add_ps(_mm_mul_ps(direction, _mm_set1_ps(0.5f * (SKYBOX_LUT_SIZE - 1))), _mm_set1_ps(0.5f * (SKYBOX_LUT_SIZE - 1)));
+        pos = _mm_min_ps(_mm_max_ps(pos, _mm_setzero_ps()), _mm_set1_ps((float)(SKYBOX_LUT_SIZE - 1)));
+        pos = _mm_shuffle_ps(pos, pos, _MM_SHUFFLE(1, 1, 1, 1));
+
+        __m128 index = _mm_floor_ps(pos);
+        __m128 frac = _mm_sub_ps(pos, index);
+        int i = _mm_cvttss_si32(index);
+
+        return _mm_add_ps(entries[i], _mm_mul_ps(_mm_sub_ps(entries[i + 1], entries[i]), frac));
+    }
+};
+
 struct Collision
 {
     bool valid;
@@ -382,6 +422,9 @@ struct Collision
 
 const Collision NO_COLLISION = {false, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, 0};
 
+/// @brief Distance returned by the baked distance functions on a miss. Not INFINITY, -Ofast assumes finite math
+const float NO_HIT_DISTANCE = FLT_MAX;
+
 inline std::pair<std::vector<size_t>, std::vector<float>> sortWithIndex(const std::vector<float> &arr)
 {
     std::vector<std::pair<float, size_t>> valueIndexPairs;
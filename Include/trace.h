@@ -0,0 +1,142 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <omp.h>
+
+/// @brief One timed span of a thread
+struct TraceEvent
+{
+    const char *name;
+    const char *category;
+    double start;
+    double end;
+    /// @brief Optional number shown with the span, e.g. the tile index. -1 for none
+    int argument;
+};
+
+/// @brief Collects timed spans of all threads and exports them in the Chrome trace event format
+/// (chrome://tracing, Perfetto). Every thread appends to its own event list, so recording needs no locks.
+/// Recording is off until Enable is called, disabled spans only cost a branch
+class Tracer
+{
+private:
+    struct ThreadEvents
+    {
+        int thread;
+        std::vector<TraceEvent> events;
+    };
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadEvents>> threads;
+    bool enabled = false;
+    double origin = 0;
+
+    /// @brief New event list for the calling thread, once per thread
+    ThreadEvents *Register()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(std::make_unique<ThreadEvents>());
+        threads.back()->thread = (int)threads.size() - 1;
+        return threads.back().get();
+    }
+
+    std::vector<TraceEvent> &LocalEvents()
+    {
+        thread_local ThreadEvents *local = Register();
+        return local->events;
+    }
+
+public:
+    inline bool Enabled() const { return enabled; }
+
+    /// @brief Starts recording
+    /// @param origin Time stamp (omp_get_wtime) that becomes 0 in the trace
+    void Enable(double origin)
+    {
+        this->origin = origin;
+        enabled = true;
+    }
+
+    /// @brief Records a finished span of the calling thread
+    /// @param start omp_get_wtime at the start of the span
+    /// @param end omp_get_wtime at the end of the span
+    inline void Record(const char *name, const char *category, double start, double end, int argument = -1)
+    {
+        if (enabled)
+        {
+            LocalEvents().push_back({name, category, start, end, argument});
+        }
+    }
+
+    /// @brief Writes all spans as Chrome trace event JSON, time stamps in microseconds
+    void Write(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream file(path);
+        if (!file.is_open())
+        {
+            std::cerr << "TRACE ERROR: UNABLE TO WRITE " << path << std::endl;
+            return;
+        }
+
+        // Fixed notation, microsecond stamps of long renders need more than the default 6 digits
+        file << std::fixed << std::setprecision(3);
+        file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (const auto &thread : threads)
+        {
+            file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread->thread
+                 << ", \"args\": {\"name\": \"" << (thread->thread == 0 ? "Main" : "Thread " + std::to_string(thread->thread)) << "\"}}";
+            first = false;
+            for (const TraceEvent &event : thread->events)
+            {
+                file << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread->thread
+                     << ", \"ts\": " << (event.start - origin) * 1e6 << ", \"dur\": " << (event.end - event.start) * 1e6;
+                if (event.argument >= 0)
+                {
+                    file << ", \"args\": {\"index\": " << event.argument << "}";
+                }
+                file << "}";
+            }
+        }
+        file << "\n]}\n";
+        std::cout << "Trace written to " << path << std::endl;
+    }
+};
+
+inline Tracer tracer;
+
+/// @brief Records the span from its construction to the end of the scope
+class ScopedTrace
+{
+private:
+    const char *name;
+    const char *category;
+    int argument;
+    double start;
+
+public:
+    ScopedTrace(const char *name, const char *category, int argument = -1)
+        : name(name), category(category), argument(argument), start(tracer.Enabled() ? omp_get_wtime() : 0) {}
+
+    ~ScopedTrace()
+    {
+        if (tracer.Enabled())
+        {
+            tracer.Record(name, category, start, omp_get_wtime(), argument);
+        }
+    }
+
+    ScopedTrace(const ScopedTrace &) = delete;
+    ScopedTrace &operator=(const ScopedTrace &) = delete;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+/// @brief Traces the rest of the current scope: TRACE_SCOPE("bake", "setup") or TRACE_SCOPE("tile", "render", index)
+#define TRACE_SCOPE(...) ScopedTrace TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
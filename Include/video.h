@@ -0,0 +1,157 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <csignal>
+#include <sys/wait.h>
+#endif
+
+/// @brief Raw video output: every final image is written as one uncompressed frame (rgb24, rgb48be for 16 bit depth)
+/// to stdout, a file or named pipe, or the stdin of an encoder process. No image files are written then
+class VideoOutput
+{
+private:
+    FILE *stream = nullptr;
+    /// @brief Stream is the stdin of a process started with popen
+    bool process = false;
+    int frames = 0;
+    /// @brief A write failed, later frames are dropped without another error
+    bool failed = false;
+    /// @brief Longest time a frame write blocked, e.g. on an encoder that is behind
+    double slowestWrite = 0;
+
+    /// @brief Replaces {width}, {height}, {format} and {fps} in the encoder command
+    static std::string ExpandCommand(std::string command, const RenderSettings &settings)
+    {
+        const std::pair<std::string, std::string> values[] = {
+            {"{width}", std::to_string(settings.resolution[0])},
+            {"{height}", std::to_string(settings.resolution[1])},
+            {"{format}", PixelFormat(settings)},
+            {"{fps}", std::to_string(settings.video_fps)}};
+        for (const auto &[key, value] : values)
+        {
+            for (size_t at = command.find(key); at != std::string::npos; at = command.find(key, at + value.size()))
+            {
+                command.replace(at, key.size(), value);
+            }
+        }
+        return command;
+    }
+
+public:
+    inline bool IsOpen() const { return stream != nullptr; }
+
+    /// @brief Seconds of the slowest frame write so far, 0 before the first frame
+    inline double SlowestWrite() const { return slowestWrite; }
+
+    /// @brief Pixel format name of the frames as ffmpeg calls it
+    static std::string PixelFormat(const RenderSettings &settings) { return settings.channel_depth == 16 ? "rgb48be" : "rgb24"; }
+
+    /// @brief Opens the output the settings ask for, nothing if neither video pipe nor command is set.
+    /// Call before anything is printed: for stdout ("-") the console output is moved to stderr, so it can not end up in the video
+    /// @return false if the output could not be opened
+    bool Open(const RenderSettings &settings)
+    {
+        if (!settings.video_command.empty())
+        {
+            std::string command = ExpandCommand(settings.video_command, settings);
+#ifdef _WIN32
+            stream = _popen(command.c_str(), "wb");
+#else
+            // A crashed encoder must not kill the renderer, the failed write is reported instead
+            std::signal(SIGPIPE, SIG_IGN);
+            stream = popen(command.c_str(), "w");
+#endif
+            process = true;
+        }
+        else if (settings.video_pipe == "-")
+        {
+            std::fflush(stdout);
+#ifdef _WIN32
+            int videoDescriptor = _dup(_fileno(stdout));
+            _dup2(_fileno(stderr), _fileno(stdout));
+            _setmode(videoDescriptor, _O_BINARY);
+            stream = _fdopen(videoDescriptor, "wb");
+#else
+            std::signal(SIGPIPE, SIG_IGN);
+            int videoDescriptor = dup(fileno(stdout));
+            dup2(fileno(stderr), fileno(stdout));
+            stream = fdopen(videoDescriptor, "wb");
+#endif
+        }
+        else if (!settings.video_pipe.empty())
+        {
+            // Blocks until a reader opens a named pipe
+            stream = std::fopen(settings.video_pipe.c_str(), "wb");
+        }
+        else
+        {
+            return true;
+        }
+
+        if (stream == nullptr)
+        {
+            std::cerr << "VIDEO ERROR: UNABLE TO OPEN " << (process ? settings.video_command : settings.video_pipe) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /// @brief Appends one frame
+    /// @param pixels Row major, 3 channels per pixel, 1 or 2 bytes per channel
+    /// @return false if the receiver is gone
+    bool WriteFrame(const std::vector<uint8_t> &pixels)
+    {
+        if (failed)
+        {
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        size_t written = std::fwrite(pixels.data(), 1, pixels.size(), stream);
+        slowestWrite = std::max(slowestWrite, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        if (written != pixels.size())
+        {
+            std::cerr << "VIDEO ERROR: UNABLE TO WRITE FRAME " << frames << ", DROPPING THE REMAINING FRAMES" << std::endl;
+            failed = true;
+            return false;
+        }
+        frames++;
+        return true;
+    }
+
+    /// @brief Flushes and closes the output, waits for the encoder process to finish
+    void Close()
+    {
+        if (stream == nullptr)
+        {
+            return;
+        }
+        int status;
+#ifdef _WIN32
+        status = process ? _pclose(stream) : std::fclose(stream);
+#else
+        status = process ? pclose(stream) : std::fclose(stream);
+        if (process && status != -1 && WIFEXITED(status))
+        {
+            status = WEXITSTATUS(status);
+        }
+#endif
+        stream = nullptr;
+        if (status != 0)
+        {
+            std::cerr << "VIDEO ERROR: " << (process ? "ENCODER EXITED WITH STATUS " : "CLOSING FAILED WITH ") << status << std::endl;
+        }
+        std::cout << frames << " frames written to the video output" << std::endl;
+    }
+};
+
+inline VideoOutput videoOutput;
@@ -0,0 +1,173 @@
+// Microbenchmarks of the hot primitives. Hidden from the normal test run, start them with: tests "[benchmark]"
+// Catch2 reports mean and deviation per call. Compare runs with --isa in main and different CPUs before changing a primitive.
+#include "catch_amalgamated.hpp"
+#include <immintrin.h>
+
+#include "../Include/tools.h"
+#include "../Include/m128Utils.h"
+#include "../Include/lightray.h"
+#include "../Include/rendersettings.h"
+#include "../Include/rendertools.h"
+#include "../Include/trace.h"
+#include "../Include/video.h"
+#include "../Include/materials.h"
+#include "../Include/objects.h"
+#include "../Include/animation.h"
+#include "../Include/scene.h"
+#include "../Include/memprep.h"
+#include "../Include/profile.h"
+#include "../Include/stats.h"
+#include "../Include/cpudispatch.h"
+#include "../Include/envmap.h"
+#include "../Include/lights.h"
+#include "../Include/sampler.h"
+#include "../Include/denoiser.h"
+#include "../Include/aov.h"
+#include "../Include/camera.h"
+
+using namespace m128Calc;
+
+/// @brief Inputs cycle through this many values, so nothing is constant folded and everything stays in L1
+const int BENCH_INPUTS = 256;
+
+/// @brief Fills BENCH_INPUTS random vectors in the unit sphere, w = 0
+static void bench_vectors(__m128 *vectors, int seed)
+{
+    __m128i state = _mm_set_epi32(seed, seed * 3 + 1, seed * 7 + 2, seed * 13 + 3);
+    for (int i = 0; i < BENCH_INPUTS; i++)
+    {
+        vectors[i] = _mm_blend_ps(random_in_unit_sphere(state), _mm_setzero_ps(), 0b1000);
+    }
+}
+
+/// @brief Reference for dot: horizontal add by shuffles instead of _mm_dp_ps
+static inline float dot_shuffle(__m128 a, __m128 b)
+{
+    __m128 m = _mm_mul_ps(a, b);
+    __m128 s = _mm_add_ps(m, _mm_movehl_ps(m, m));
+    s = _mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(s);
+}
+
+TEST_CASE("m128Calc primitives", "[.][benchmark]")
+{
+    __m128 a[BENCH_INPUTS], b[BENCH_INPUTS];
+    bench_vectors(a, 1);
+    bench_vectors(b, 2);
+    int i = 0;
+
+    BENCHMARK("dot (_mm_dp_ps)") { i = (i + 1) % BENCH_INPUTS; return dot(a[i], b[i]); };
+    BENCHMARK("dot (shuffle add)") { i = (i + 1) % BENCH_INPUTS; return dot_shuffle(a[i], b[i]); };
+    BENCHMARK("cross") { i = (i + 1) % BENCH_INPUTS; return cross(a[i], b[i]); };
+    BENCHMARK("normalized") { i = (i + 1) % BENCH_INPUTS; return normalized(a[i]); };
+    BENCHMARK("mirrorToNormalized") { i = (i + 1) % BENCH_INPUTS; return mirrorToNormalized(a[i], normalized(b[i])); };
+    BENCHMARK("exp4") { i = (i + 1) % BENCH_INPUTS; return exp4(_mm_mul_ps(a[i], _mm_set1_ps(10.0f))); };
+    BENCHMARK("cosineHemisphere4")
+    {
+        i = (i + 1) % BENCH_INPUTS;
+        __m128 directions[4];
+        cosineHemisphere4(normalized(a[i]), _mm_andnot_ps(_mm_set1_ps(-0.0f), b[i]), _mm_andnot_ps(_mm_set1_ps(-0.0f), a[i]), directions);
+        return directions[3];
+    };
+
+    __m128i seed = _mm_set_epi32(1, 2, 3, 4);
+    BENCHMARK("randomvec") { return randomvec(seed); };
+}
+
+TEST_CASE("Skybox gradient", "[.][benchmark]")
+{
+    std::vector<float> marks = {0.0f, 0.15f, 0.46f, 0.52f, 0.6f, 1.1f};
+    alignas(16) __m128 points[6] = {
+        Vec3{0.0f, 0.02f, 0.08f}.data, Vec3{0.3f, 0.2f, 0.5f}.data, Vec3{0.8314f, 0.8118f, 0.7922f}.data,
+        Vec3{0.9331f, 0.8118f, 0.3922f}.data, Vec3{0.8039f, 0.8667f, 0.9294f}.data, Vec3{0.2353f, 0.2471f, 0.3686f}.data};
+    SkyboxLUT lut;
+    lut.Bake(points, marks);
+    __m128 directions[BENCH_INPUTS];
+    bench_vectors(directions, 3);
+    for (__m128 &d : directions)
+    {
+        d = normalized(d);
+    }
+    int i = 0;
+
+    BENCHMARK("get_gradient") { i = (i + 1) % BENCH_INPUTS; return get_gradient(points, marks, 0.5f * (getY(directions[i]) + 1)); };
+    BENCHMARK("SkyboxLUT::Lookup") { i = (i + 1) % BENCH_INPUTS; return lut.Lookup(directions[i]); };
+}
+
+/// @brief Bakes the objects and benchmarks closest hit and occlusion queries of every ISA level this CPU supports
+static void benchmark_collision(const std::string &name, std::vector<Object *> &objects)
+{
+    BakedScene scene = bake_into_memory(objects);
+    __m128 directions[BENCH_INPUTS];
+    bench_vectors(directions, 4);
+    std::vector<LightRay> rays;
+    for (const __m128 &d : directions)
+    {
+        // Rays from the camera position of the scenes into the +z half space
+        rays.push_back(LightRay(_mm_set_ps(0, -10, 0, 0), normalized(_mm_add_ps(d, _mm_set_ps(0, 2, 0, 0)))));
+    }
+
+    const IsaLevel detected = DetectIsaLevel();
+    const KernelTable tables[3] = {isa_sse41::kernels, isa_avx2::kernels, isa_avx512::kernels};
+    for (int level = 0; level <= (int)detected; level++)
+    {
+        const KernelTable &table = tables[level];
+        int i = 0;
+        BENCHMARK(name + " MemoryCollision " + table.name)
+        {
+            i = (i + 1) % BENCH_INPUTS;
+            const float *hitObject;
+            return table.memoryCollision(rays[i], scene, hitObject).distance;
+        };
+        BENCHMARK(name + " MemoryOcclusion " + table.name)
+        {
+            i = (i + 1) % BENCH_INPUTS;
+            return table.memoryOcclusion(rays[i], scene, NO_HIT_DISTANCE);
+        };
+    }
+
+    free_baked_scene(scene);
+    for (Object *object : objects)
+    {
+        delete object;
+    }
+}
+
+TEST_CASE("Intersection kernels", "[.][benchmark]")
+{
+    Material material("white", Vec3(1, 1, 1), 0.5f, 0.5f);
+
+    // 64 spheres in an 8x8 grid in front of the rays, 8 full blocks for the 8-wide kernels
+    std::vector<Object *> spheres;
+    for (int y = 0; y < 8; y++)
+    {
+        for (int x = 0; x < 8; x++)
+        {
+            spheres.push_back(new Sphere(Vec3(x - 3.5f, y - 3.5f, 5.0f + (x + y) % 3), 0.3f, material));
+        }
+    }
+    benchmark_collision("64 spheres", spheres);
+
+    // 16 planes facing the rays at different depths
+    std::vector<Object *> planes;
+    for (int p = 0; p < 16; p++)
+    {
+        planes.push_back(new Plane(Vec3(p % 4 - 1.5f, p / 4 - 1.5f, 5.0f + p), Vec3(0, 0, 0), Vec3(0.5f, 0.5f, 0.5f), material));
+    }
+    benchmark_collision("16 planes", planes);
+}
+
+TEST_CASE("Ray generation", "[.][benchmark]")
+{
+    RenderSettings settings;
+    Scene scene;
+    Camera camera(Vec3(0, 0, -8), Vec3(0, 0, 0), 45, settings, scene, true);
+    const int width = settings.resolution[0];
+    int pixel = 0;
+
+    BENCHMARK("GenerateRayFromPixel")
+    {
+        pixel = (pixel + 1) % (width * settings.resolution[1]);
+        return camera.GenerateRayFromPixel(pixel % width + 0.5f, pixel / width + 0.5f).direction;
+    };
+}
@@ -0,0 +1,99 @@
+#include "catch_amalgamated.hpp"
+#include <immintrin.h>
+
+#include "../Include/tools.h"
+#include "../Include/m128Utils.h"
+#include "../Include/lightray.h"
+#include "../Include/rendersettings.h"
+#include "../Include/trace.h"
+#include "../Include/materials.h"
+#include "../Include/objects.h"
+#include "../Include/memprep.h"
+#include "../Include/animation.h"
+
+/// @brief Baked scene of one plane and 10 spheres in a row, objects in scene file order
+struct AnimatedScene
+{
+    std::vector<Object *> objects;
+    BakedScene baked;
+
+    AnimatedScene()
+    {
+        Material material("white", Vec3(1, 1, 1), 0.5f, 0.5f);
+        objects.push_back(new Plane(Vec3(0, -1, 0), Vec3(0, 0, 0), Vec3(5, 5, 5), material));
+        for (int i = 0; i < 10; i++)
+        {
+            objects.push_back(new Sphere(Vec3((float)i, 0, 0), 0.5f, material));
+        }
+        baked = bake_into_memory(objects);
+    }
+
+    ~AnimatedScene()
+    {
+        free_baked_scene(baked);
+        for (Object *object : objects)
+        {
+            delete object;
+        }
+    }
+
+    /// @brief Block lane of a sphere, -1 if it is in no block
+    int Lane(size_t sphereIndex) const
+    {
+        for (size_t lane = 0; lane < 8 * baked.sphereBlockCount; lane++)
+        {
+            if (baked.sphereOrder[lane] == sphereIndex)
+            {
+                return (int)lane;
+            }
+        }
+        return -1;
+    }
+};
+
+TEST_CASE("Animation interpolates keyframes into the baked memory", "[animation]")
+{
+    AnimatedScene scene;
+    Animation animation;
+    // Object 11 is the last sphere, object 1 the plane
+    animation.AddKeyframe(11, 10, _mm_set_ps(0, 4, 2, 9));
+    animation.AddKeyframe(11, 0, _mm_set_ps(0, 0, 0, 9));
+    animation.AddKeyframe(1, 5, _mm_set_ps(0, 0, -2, 0));
+    REQUIRE(animation.Active());
+    REQUIRE(animation.Frames() == 11);
+    animation.Bind(scene.baked);
+    REQUIRE(animation.MovesSpheres());
+
+    animation.Apply(5);
+    const float *sphere = scene.baked.spheres + 28 * 9;
+    REQUIRE(sphere[0] == Catch::Approx(9));
+    REQUIRE(sphere[1] == Catch::Approx(1));
+    REQUIRE(sphere[2] == Catch::Approx(2));
+    REQUIRE(scene.baked.planes[0] == Catch::Approx(0));
+    REQUIRE(scene.baked.planes[1] == Catch::Approx(-2));
+
+    // The sphere blocks follow after the BVH update
+    update_sphere_bvh(scene.baked, 1.5f);
+    int lane = scene.Lane(9);
+    REQUIRE(lane >= 0);
+    const float *block = scene.baked.sphereBlocks + 32 * (lane / 8);
+    REQUIRE(block[lane % 8] == sphere[0]);
+    REQUIRE(block[8 + lane % 8] == sphere[1]);
+    REQUIRE(block[16 + lane % 8] == sphere[2]);
+
+    // Before the first and after the last keyframe the objects stand still
+    animation.Apply(0);
+    REQUIRE(sphere[1] == Catch::Approx(0));
+    animation.Apply(20);
+    REQUIRE(sphere[1] == Catch::Approx(2));
+    REQUIRE(sphere[2] == Catch::Approx(4));
+    // Objects without keyframes are not touched
+    REQUIRE(scene.baked.spheres[28 * 8] == Catch::Approx(8));
+}
+
+TEST_CASE("Animation frame paths", "[animation]")
+{
+    REQUIRE(RenderSettings::FramePath("render.ppm", 7) == "render_0007.ppm");
+    REQUIRE(RenderSettings::FramePath("out.d/render", 12) == "out.d/render_0012");
+    REQUIRE(RenderSettings::FramePath("", 3).empty());
+}
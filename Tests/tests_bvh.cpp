@@ -0,0 +1,211 @@
+#include "catch_amalgamated.hpp"
+#include <immintrin.h>
+#include <random>
+#include <fstream>
+#include <cstdio>
+
+#include "../Include/tools.h"
+#include "../Include/m128Utils.h"
+#include "../Include/lightray.h"
+#include "../Include/rendersettings.h"
+#include "../Include/trace.h"
+#include "../Include/materials.h"
+#include "../Include/objects.h"
+#include "../Include/memprep.h"
+#include "../Include/profile.h"
+#include "../Include/stats.h"
+#include "../Include/cpudispatch.h"
+
+/// @brief Checks that every sphere is in exactly one leaf lane and every box contains its spheres and children
+static void require_valid_bvh(const BakedScene &baked)
+{
+    std::vector<int> seen(baked.sphereCount, 0);
+    size_t leafBlocks = 0;
+    for (size_t n = 0; n < baked.bvhNodeCount; n++)
+    {
+        const BvhNode &node = baked.bvhNodes[n];
+        BvhBounds bounds = load_node_bounds(node);
+        BvhBounds content;
+        if (node.count == 0)
+        {
+            REQUIRE(node.first > n);
+            REQUIRE(node.first + 1 < baked.bvhNodeCount);
+            content.Grow(load_node_bounds(baked.bvhNodes[node.first]));
+            content.Grow(load_node_bounds(baked.bvhNodes[node.first + 1]));
+        }
+        else
+        {
+            leafBlocks += node.count;
+            for (uint32_t lane = 8 * node.first; lane < 8 * (node.first + node.count); lane++)
+            {
+                uint32_t sphereIndex = baked.sphereOrder[lane];
+                if (sphereIndex == BVH_PADDING)
+                {
+                    REQUIRE(baked.sphereBlocks[32 * (lane / 8) + 24 + lane % 8] < 0);
+                    continue;
+                }
+                REQUIRE(sphereIndex < baked.sphereCount);
+                seen[sphereIndex]++;
+                const float *sphere = baked.spheres + 28 * (size_t)sphereIndex;
+                REQUIRE(baked.sphereBlocks[32 * (lane / 8) + lane % 8] == sphere[0]);
+                __m128 lower, upper;
+                sphere_bounds(sphere, lower, upper);
+                content.Grow(lower, upper);
+            }
+        }
+        REQUIRE((_mm_movemask_ps(_mm_cmpgt_ps(bounds.min, content.min)) & 0b0111) == 0);
+        REQUIRE((_mm_movemask_ps(_mm_cmplt_ps(bounds.max, content.max)) & 0b0111) == 0);
+    }
+    REQUIRE(leafBlocks == baked.sphereBlockCount);
+    REQUIRE(std::count(seen.begin(), seen.end(), 1) == (long)baked.sphereCount);
+    REQUIRE(baked.bvhLevels[0] == 0);
+    REQUIRE(baked.bvhLevels[baked.bvhLevelCount] == baked.bvhNodeCount);
+}
+
+TEST_CASE("Sphere BVH build and refit", "[bvh]")
+{
+    Material material("white", Vec3(1, 1, 1), 0.5f, 0.5f);
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> coordinate(-20, 20);
+    std::vector<Object *> objects;
+    for (int i = 0; i < 1000; i++)
+    {
+        objects.push_back(new Sphere(Vec3(coordinate(random), coordinate(random), coordinate(random)), 0.5f, material));
+    }
+    // Spheres at the same spot can not be split by position
+    for (int i = 0; i < 100; i++)
+    {
+        objects.push_back(new Sphere(Vec3(30, 30, 30), 0.5f, material));
+    }
+    BakedScene baked = bake_into_memory(objects);
+    REQUIRE(baked.bvhNodeCount > 1);
+    require_valid_bvh(baked);
+
+    // Small moves are refitted, scattering all spheres makes the tree bad enough for a rebuild
+    for (size_t i = 0; i < baked.sphereCount; i++)
+    {
+        baked.spheres[28 * i] += 0.1f;
+    }
+    REQUIRE_FALSE(update_sphere_bvh(baked, 1.5f));
+    require_valid_bvh(baked);
+    for (size_t i = 0; i < baked.sphereCount; i++)
+    {
+        baked.spheres[28 * i + 1] = coordinate(random);
+    }
+    REQUIRE(update_sphere_bvh(baked, 1.5f));
+    require_valid_bvh(baked);
+    REQUIRE(bvh_sah_cost(baked) == Catch::Approx(baked.bvhBuildCost));
+
+    free_baked_scene(baked);
+    for (Object *object : objects)
+    {
+        delete object;
+    }
+}
+
+TEST_CASE("Sphere BVH traversal of axis aligned rays on node boundaries", "[bvh]")
+{
+    // The sphere at x = 4 alone reaches down to x = 3, the boundary of the root and its leaf. The rays run along z inside
+    // that boundary plane, their direction is 0 in x and y and they touch the sphere at z = 10
+    Material material("white", Vec3(1, 1, 1), 0.5f, 0.5f);
+    std::vector<Object *> objects = {new Sphere(Vec3(4, 0, 10), 1.0f, material)};
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> x(6.0f, 20.0f);
+    std::uniform_real_distribution<float> yz(-10.0f, 10.0f);
+    for (int i = 0; i < 300; i++)
+    {
+        objects.push_back(new Sphere(Vec3(x(rng), yz(rng), yz(rng)), 0.5f, material));
+    }
+    BakedScene baked = bake_into_memory(objects);
+    REQUIRE(baked.bvhNodes[0].count == 0);
+    REQUIRE(baked.bvhNodes[0].min[0] == 3.0f);
+
+    const LightRay forward(_mm_setr_ps(3, 0, 0, 0), _mm_setr_ps(0, 0, 1, 0));
+    const LightRay backward(_mm_setr_ps(3, 0, 20, 0), _mm_setr_ps(-0.0f, -0.0f, -1, 0));
+
+    // Slab test of single boxes: the box the ray runs along the face of is entered at z = 2,
+    // the boxes beside it in x and in y are missed
+    const BvhNode face = {{3, -1, 2}, 0, {5, 1, 4}, 1};
+    const BvhNode besideX = {{3.5f, -1, 2}, 0, {5, 1, 4}, 1};
+    const BvhNode besideY = {{3, 0.5f, 2}, 0, {5, 1, 4}, 1};
+    const isa_sse41::BvhRay bvhRay(forward);
+    REQUIRE(isa_sse41::NodeDistance(bvhRay, face, NO_HIT_DISTANCE) == Catch::Approx(2.0f));
+    REQUIRE(isa_sse41::NodeDistance(bvhRay, besideX, NO_HIT_DISTANCE) == NO_HIT_DISTANCE);
+    REQUIRE(isa_sse41::NodeDistance(bvhRay, besideY, NO_HIT_DISTANCE) == NO_HIT_DISTANCE);
+    REQUIRE(isa_sse41::NodeDistance(isa_sse41::BvhRay(backward), face, NO_HIT_DISTANCE) == Catch::Approx(16.0f));
+
+    const KernelTable tables[3] = {isa_sse41::kernels, isa_avx2::kernels, isa_avx512::kernels};
+    for (int level = 0; level <= (int)DetectIsaLevel(); level++)
+    {
+        INFO(tables[level].name);
+        const float *hitObject;
+        REQUIRE(tables[level].memoryCollision(forward, baked, hitObject).distance == Catch::Approx(10.0f));
+        REQUIRE(hitObject == baked.spheres);
+        REQUIRE(tables[level].memoryCollision(backward, baked, hitObject).distance == Catch::Approx(10.0f));
+        REQUIRE(hitObject == baked.spheres);
+        REQUIRE(tables[level].memoryOcclusion(forward, baked, 11.0f));
+        REQUIRE(tables[level].memoryOcclusion(backward, baked, 11.0f));
+    }
+
+    free_baked_scene(baked);
+    for (Object *object : objects)
+    {
+        delete object;
+    }
+}
+
+/// @brief Writes a baked object file of spheres along x, the header may claim other counts than the body holds
+static void write_baked_file(const std::string &path, uint64_t sphereCount, uint64_t planeCount, int bodySpheres)
+{
+    Material material("white", Vec3(1, 1, 1), 0.5f, 0.5f);
+    std::ofstream file(path, std::ios::binary);
+    BakedFileHeader header = make_baked_header(sphereCount, planeCount);
+    file.write((const char *)&header, sizeof(header));
+    alignas(16) float slot[28] = {};
+    for (int i = 0; i < bodySpheres; i++)
+    {
+        Sphere sphere(Vec3(2.0f * i, 0, 0), 0.5f, material);
+        bake_object(slot, &sphere, i + 1);
+        file.write((const char *)slot, sizeof(slot));
+    }
+}
+
+TEST_CASE("Baked files must match the object counts of their header", "[baked]")
+{
+    const std::string path = "tests_bvh.baked";
+    Material material("white", Vec3(1, 1, 1), 0.5f, 0.5f);
+    std::vector<Object *> objects = {new Sphere(Vec3(0, 5, 0), 1.0f, material)};
+
+    write_baked_file(path, 3, 0, 3);
+    {
+        std::ifstream file(path, std::ios::binary);
+        BakedFileHeader header;
+        REQUIRE(read_baked_header(file, header));
+    }
+    BakedScene baked = bake_into_memory(objects, {path});
+    REQUIRE(baked.sphereCount == 4);
+    free_baked_scene(baked);
+
+    // A short body, and counts that would overflow the allocation, reject the whole file
+    write_baked_file(path, 3, 0, 2);
+    baked = bake_into_memory(objects, {path});
+    REQUIRE(baked.sphereCount == 1);
+    REQUIRE(baked.planeCount == 0);
+    free_baked_scene(baked);
+
+    write_baked_file(path, UINT64_MAX / 56, UINT64_MAX / 56, 3);
+    {
+        std::ifstream file(path, std::ios::binary);
+        BakedFileHeader header;
+        REQUIRE_FALSE(read_baked_header(file, header));
+    }
+    baked = bake_into_memory(objects, {path});
+    REQUIRE(baked.sphereCount == 1);
+    free_baked_scene(baked);
+
+    std::remove(path.c_str());
+    for (Object *object : objects)
+    {
+        delete object;
+    }
+}
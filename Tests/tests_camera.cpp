@@ -0,0 +1,105 @@
+#include "catch_amalgamated.hpp"
+#include <immintrin.h>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../Include/tools.h"
+#include "../Include/m128Utils.h"
+#include "../Include/lightray.h"
+#include "../Include/rendersettings.h"
+#include "../Include/rendertools.h"
+#include "../Include/trace.h"
+#include "../Include/video.h"
+#include "../Include/materials.h"
+#include "../Include/objects.h"
+#include "../Include/animation.h"
+#include "../Include/scene.h"
+#include "../Include/memprep.h"
+#include "../Include/profile.h"
+#include "../Include/stats.h"
+#include "../Include/cpudispatch.h"
+#include "../Include/envmap.h"
+#include "../Include/lights.h"
+#include "../Include/sampler.h"
+#include "../Include/denoiser.h"
+#include "../Include/aov.h"
+#include "../Include/camera.h"
+
+/// @brief Reads a grayscale Portable Float Map written by write_pfm, row major from the top
+static std::vector<float> read_pfm(const std::string &path, int width, int height)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    int fileWidth = 0;
+    int fileHeight = 0;
+    float scale;
+    file >> magic >> fileWidth >> fileHeight >> scale;
+    file.get();
+    REQUIRE(magic == "Pf");
+    REQUIRE(fileWidth == width);
+    REQUIRE(fileHeight == height);
+    std::vector<float> values((size_t)width * height);
+    for (int y = height - 1; y >= 0; y--)
+    {
+        file.read((char *)(values.data() + (size_t)y * width), width * sizeof(float));
+    }
+    REQUIRE(file);
+    return values;
+}
+
+/// @brief Renders the scene with adaptive sampling under a constant sky
+/// @return Samples of every pixel, as recorded in the samples AOV
+static std::vector<float> render_adaptive(Scene &scene, int width, int height)
+{
+    RenderSettings settings({width, height}, "tests_camera.ppm", 8);
+    settings.supersampling_steps = 1;
+    settings.bounces = 2;
+    settings.scatterbase = 2;
+    settings.scatterredux = 1;
+    settings.smoothing = false;
+    settings.adaptive = true;
+    settings.adaptive_min_samples = 8;
+    settings.adaptive_max_samples = 64;
+    settings.adaptive_error = 0.02f;
+    settings.aov_samples_path = "tests_camera_samples.pfm";
+
+    const Vec3 sky(0.6f, 0.7f, 0.9f);
+    {
+        Camera camera(Vec3(0, 0, 10), Vec3(0, 0, 0), 40, settings, scene, true, {0.0f, 1.1f}, {sky, sky});
+        camera.RenderFull();
+    }
+    std::vector<float> samples = read_pfm(settings.aov_samples_path, width, height);
+    std::remove(settings.output_path.c_str());
+    std::remove(settings.aov_samples_path.c_str());
+    return samples;
+}
+
+TEST_CASE("Adaptive sampling stops early on constant pixels", "[adaptive]")
+{
+    const int width = 12;
+    const int height = 8;
+
+    // Every ray sees the same sky color, no pixel has any variance
+    Scene empty;
+    for (float samples : render_adaptive(empty, width, height))
+    {
+        REQUIRE(samples == 8);
+    }
+
+    // A diffuse sphere lit by the sky is noisy, its pixels need more samples while the sky around it stays at the minimum
+    Material material("white", Vec3(0.8f, 0.8f, 0.8f), 0.5f, 1.0f);
+    Scene sphere;
+    sphere.objects.push_back(new Sphere(Vec3(0, 0, 0), 1.5f, material));
+    std::vector<float> samples = render_adaptive(sphere, width, height);
+    delete sphere.objects[0];
+    REQUIRE(samples[0] == 8);
+    REQUIRE(samples[width * height - 1] == 8);
+    REQUIRE(samples[(height / 2) * width + width / 2] > 8);
+    for (float count : samples)
+    {
+        REQUIRE(count >= 8);
+        REQUIRE(count <= 64);
+    }
+}
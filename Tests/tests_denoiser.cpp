@@ -0,0 +1,106 @@
+#define CATCH_CONFIG_MAIN
+#include "catch_amalgamated.hpp"
+#include "../Include/denoiser.h"
+#include <immintrin.h>
+#include <random>
+#include <vector>
+
+/// @brief Image and features of a flat wall, the right half faces another direction and is further away
+struct TestImage
+{
+    static const int width = 64;
+    static const int height = 48;
+    __m128 *color;
+    __m128 *normal;
+    __m128 *albedo;
+    float *depth;
+    DenoiseFeatures features;
+
+    TestImage()
+    {
+        color = (__m128 *)allocate_aligned(16, width * height * sizeof(__m128));
+        normal = (__m128 *)allocate_aligned(16, width * height * sizeof(__m128));
+        albedo = (__m128 *)allocate_aligned(16, width * height * sizeof(__m128));
+        depth = (float *)allocate_aligned(16, width * height * sizeof(float));
+        for (int p = 0; p < width * height; p++)
+        {
+            bool right = p % width >= width / 2;
+            normal[p] = right ? _mm_setr_ps(1, 0, 0, 0) : _mm_setr_ps(0, 0, 1, 0);
+            albedo[p] = _mm_setr_ps(0.8f, 0.5f, 0.2f, 0);
+            depth[p] = right ? 20.0f : 10.0f;
+        }
+        features = {normal, albedo, depth};
+    }
+
+    ~TestImage()
+    {
+        free_aligned(color);
+        free_aligned(normal);
+        free_aligned(albedo);
+        free_aligned(depth);
+    }
+
+    /// @brief Mean and variance of the red channel over the columns [x0, x1)
+    void Statistics(int x0, int x1, double &mean, double &variance) const
+    {
+        double sum = 0, squares = 0;
+        int n = 0;
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = x0; x < x1; x++)
+            {
+                double r = _mm_cvtss_f32(color[y * width + x]);
+                sum += r;
+                squares += r * r;
+                n++;
+            }
+        }
+        mean = sum / n;
+        variance = squares / n - mean * mean;
+    }
+};
+
+TEST_CASE("Denoiser keeps a constant image", "[Denoiser]")
+{
+    TestImage image;
+    for (int p = 0; p < image.width * image.height; p++)
+    {
+        image.color[p] = _mm_mul_ps(image.albedo[p], _mm_set1_ps(0.6f));
+    }
+    denoise_atrous(image.color, image.features, image.width, image.height, 5, 0.5f, 0.3f, 0.02f);
+    for (int p = 0; p < image.width * image.height; p++)
+    {
+        REQUIRE(_mm_cvtss_f32(image.color[p]) == Catch::Approx(0.48f).margin(1e-4));
+    }
+}
+
+TEST_CASE("Denoiser removes noise but keeps edges", "[Denoiser]")
+{
+    // Noisy light on both halves, the left half twice as bright
+    TestImage image;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> noise(0.5f, 1.5f);
+    for (int p = 0; p < image.width * image.height; p++)
+    {
+        float light = (p % image.width >= image.width / 2) ? 0.25f : 0.5f;
+        image.color[p] = _mm_mul_ps(image.albedo[p], _mm_set1_ps(light * noise(rng)));
+    }
+    double meanBefore, varianceBefore;
+    image.Statistics(0, image.width / 2, meanBefore, varianceBefore);
+
+    denoise_atrous(image.color, image.features, image.width, image.height, 5, 0.5f, 0.3f, 0.02f);
+
+    double meanLeft, varianceLeft, meanRight, varianceRight;
+    image.Statistics(0, image.width / 2, meanLeft, varianceLeft);
+    image.Statistics(image.width / 2, image.width, meanRight, varianceRight);
+    REQUIRE(varianceLeft < varianceBefore * 0.1);
+    REQUIRE(meanLeft == Catch::Approx(0.8 * 0.5).epsilon(0.05));
+    REQUIRE(meanRight == Catch::Approx(0.8 * 0.25).epsilon(0.05));
+
+    // Columns right at the edge do not bleed into each other
+    double meanEdgeLeft, varianceEdge, meanEdgeRight;
+    image.Statistics(image.width / 2 - 1, image.width / 2, meanEdgeLeft, varianceEdge);
+    image.Statistics(image.width / 2, image.width / 2 + 1, meanEdgeRight, varianceEdge);
+    REQUIRE(meanEdgeLeft == Catch::Approx(0.8 * 0.5).epsilon(0.05));
+    REQUIRE(meanEdgeRight == Catch::Approx(0.8 * 0.25).epsilon(0.05));
+}
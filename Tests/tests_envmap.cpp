@@ -0,0 +1,113 @@
+#include "catch_amalgamated.hpp"
+#include <immintrin.h>
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <fstream>
+#include <vector>
+
+#include "../Include/tools.h"
+#include "../Include/m128Utils.h"
+#include "../Include/lightray.h"
+#include "../Include/rendersettings.h"
+#include "../Include/trace.h"
+#include "../Include/materials.h"
+#include "../Include/objects.h"
+#include "../Include/memprep.h"
+#include "../Include/rendertools.h"
+#include "../Include/envmap.h"
+
+/// @brief Writes a small sky with a bright sun as Portable Float Map
+static void write_test_map(const std::string &path, int width, int height)
+{
+    std::vector<float> rgb(width * height * 3);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            float *texel = &rgb[(y * width + x) * 3];
+            texel[0] = 0.2f + 0.05f * x;
+            texel[1] = 0.3f + 0.1f * y;
+            texel[2] = 0.5f;
+            if (x >= 20 && x < 23 && y >= 4 && y < 6)
+            {
+                texel[0] = texel[1] = texel[2] = 200.0f;
+            }
+        }
+    }
+    REQUIRE(write_pfm(path, rgb.data(), 3, 3, width, height));
+}
+
+TEST_CASE("Environment map pdf matches the density of its samples", "[envmap]")
+{
+    const int width = 32;
+    const int height = 16;
+    const std::string path = "tests_envmap.pfm";
+    write_test_map(path, width, height);
+    EnvironmentMap map(path, 1.0f);
+    std::remove(path.c_str());
+    REQUIRE(map.Valid());
+    REQUIRE(map.CanSample());
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    int sunSamples = 0;
+    const int count = 4000;
+    for (int i = 0; i < count; i++)
+    {
+        EnvironmentSample sample = map.Sample(uniform(rng), uniform(rng));
+        REQUIRE(sample.pdf > 0.0f);
+        REQUIRE(norm2(sample.direction) == Catch::Approx(1.0f).epsilon(1e-4));
+        REQUIRE(map.Pdf(sample.direction) == Catch::Approx(sample.pdf).epsilon(1e-3));
+        if (luminance(sample.radiance) > 100.0f)
+        {
+            sunSamples++;
+        }
+    }
+    // The 6 sun texels carry most of the weight of the 512 texel map
+    CHECK(sunSamples > count / 2);
+
+    // The pdf integrates to one over the sphere
+    double integral = 0;
+    const int directions = 200000;
+    for (int i = 0; i < directions; i++)
+    {
+        float z = 1.0f - 2.0f * uniform(rng);
+        float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+        float phi = 2.0f * (float)M_PI * uniform(rng);
+        integral += map.Pdf(_mm_set_ps(0, z, r * std::sin(phi), r * std::cos(phi)));
+    }
+    CHECK(integral * 4.0 * M_PI / directions == Catch::Approx(1.0).epsilon(0.03));
+}
+
+TEST_CASE("Environment maps with broken headers are rejected before allocating", "[envmap]")
+{
+    const std::string pfm = "tests_envmap_broken.pfm";
+    const std::string hdr = "tests_envmap_broken.hdr";
+    const std::vector<std::string> pfmHeaders = {"PF\n-4 2\n-1.0\n", "PF\n2000000000 2000000000\n-1.0\n", "PF\n40000 30000\n-1.0\n",
+                                                 "PF\n8 4\n-1.0\n", "PF\nfour two\n-1.0\n"};
+    for (const std::string &header : pfmHeaders)
+    {
+        {
+            std::ofstream file(pfm, std::ios::binary);
+            file << header;
+            // A body for 4x2 texels, too short for every valid header above
+            std::vector<float> body(4 * 2 * 3, 1.0f);
+            file.write((const char *)body.data(), body.size() * sizeof(float));
+        }
+        EnvironmentMap map(pfm, 1.0f);
+        CHECK_FALSE(map.Valid());
+    }
+
+    {
+        std::ofstream file(hdr, std::ios::binary);
+        file << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y 2000000000 +X 2000000000\n";
+        file << std::string(64, '\x80');
+    }
+    EnvironmentMap map(hdr, 1.0f);
+    CHECK_FALSE(map.Valid());
+
+    std::remove(pfm.c_str());
+    std::remove(hdr.c_str());
+}
@@ -0,0 +1,279 @@
+#include "catch_amalgamated.hpp"
+#include <immintrin.h>
+#include <cmath>
+#include <random>
+
+#include "../Include/tools.h"
+#include "../Include/m128Utils.h"
+#include "../Include/lightray.h"
+#include "../Include/rendersettings.h"
+#include "../Include/trace.h"
+#include "../Include/materials.h"
+#include "../Include/objects.h"
+#include "../Include/memprep.h"
+#include "../Include/profile.h"
+#include "../Include/stats.h"
+#include "../Include/cpudispatch.h"
+
+using namespace m128Calc;
+
+/// @brief Kernel tables of every ISA level this CPU supports (CPUID), the others can not run here
+static std::vector<KernelTable> supported_tables()
+{
+    const KernelTable tables[3] = {isa_sse41::kernels, isa_avx2::kernels, isa_avx512::kernels};
+    return std::vector<KernelTable>(tables, tables + (int)DetectIsaLevel() + 1);
+}
+
+/// @brief Scalar reference for the baked distance functions, in double precision
+/// @return Distance, NO_HIT_DISTANCE if missed
+static double reference_distance(const LightRay &ray, const float *object, bool sphere)
+{
+    alignas(16) float o[4], d[4];
+    _mm_store_ps(o, ray.origin);
+    _mm_store_ps(d, ray.direction);
+    if (sphere)
+    {
+        double L[3] = {object[0] - o[0], object[1] - o[1], object[2] - o[2]};
+        double tca = L[0] * d[0] + L[1] * d[1] + L[2] * d[2];
+        double d2 = L[0] * L[0] + L[1] * L[1] + L[2] * L[2] - tca * tca;
+        double radius2 = (double)object[4] * object[4];
+        if (d2 > radius2)
+        {
+            return NO_HIT_DISTANCE;
+        }
+        double thc = std::sqrt(radius2 - d2);
+        double t = tca - thc < 0 ? tca + thc : tca - thc;
+        return t > 0.001 ? t : NO_HIT_DISTANCE;
+    }
+    const float *n = object + 8;
+    double divider = d[0] * n[0] + d[1] * n[1] + d[2] * n[2];
+    if (std::abs(divider) <= 0.001)
+    {
+        return NO_HIT_DISTANCE;
+    }
+    double t = ((object[0] - o[0]) * n[0] + (object[1] - o[1]) * n[1] + (object[2] - o[2]) * n[2]) / divider;
+    double diff[3] = {o[0] + t * d[0] - object[0], o[1] + t * d[1] - object[1], o[2] + t * d[2] - object[2]};
+    double x = diff[0] * object[12] + diff[1] * object[13] + diff[2] * object[14];
+    double y = diff[0] * object[16] + diff[1] * object[17] + diff[2] * object[18];
+    bool inside = std::abs(x) <= object[4] && std::abs(y) <= object[5];
+    return inside && t > 0.001 ? t : NO_HIT_DISTANCE;
+}
+
+/// @brief Clustered random spheres (several BVH leaves and padded blocks) and a few planes
+struct KernelScene
+{
+    std::vector<Object *> objects;
+    BakedScene baked;
+
+    KernelScene()
+    {
+        Material material("white", Vec3(1, 1, 1), 0.5f, 0.5f);
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> position(-5.0f, 5.0f);
+        std::uniform_real_distribution<float> radius(0.1f, 0.8f);
+        for (int i = 0; i < 203; i++)
+        {
+            objects.push_back(new Sphere(Vec3(position(rng), position(rng), position(rng) + 10.0f), radius(rng), material));
+        }
+        objects.push_back(new Plane(Vec3(0, -6, 10), Vec3(0, 0, 0), Vec3(4, 4, 4), material));
+        objects.push_back(new Plane(Vec3(2, 0, 18), Vec3(0.5f, 0.3f, 0), Vec3(6, 3, 3), material));
+        baked = bake_into_memory(objects);
+    }
+
+    ~KernelScene()
+    {
+        free_baked_scene(baked);
+        for (Object *object : objects)
+        {
+            delete object;
+        }
+    }
+
+    /// @brief Closest object by brute force over all objects
+    /// @return Index in the baked memory (spheres first, then planes), -1 for a miss
+    int ReferenceHit(const LightRay &ray, double &distance) const
+    {
+        int closest = -1;
+        distance = NO_HIT_DISTANCE;
+        for (size_t i = 0; i < baked.sphereCount + baked.planeCount; i++)
+        {
+            bool sphere = i < baked.sphereCount;
+            double t = reference_distance(ray, sphere ? baked.spheres + 28 * i : baked.planes + 28 * (i - baked.sphereCount), sphere);
+            if (t < distance)
+            {
+                distance = t;
+                closest = (int)i;
+            }
+        }
+        return closest;
+    }
+
+    /// @brief Index of a hit object in the baked memory, -1 for nullptr
+    int Index(const float *object) const
+    {
+        if (object == nullptr)
+        {
+            return -1;
+        }
+        return object < baked.planes ? (int)((object - baked.spheres) / 28) : (int)(baked.sphereCount + (object - baked.planes) / 28);
+    }
+};
+
+TEST_CASE("Kernel tables of every ISA level find the same hits", "[kernels]")
+{
+    KernelScene scene;
+    REQUIRE(scene.baked.sphereCount == 203);
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    const std::vector<KernelTable> tables = supported_tables();
+    int hits = 0;
+    int occluded = 0;
+    for (int r = 0; r < 4000; r++)
+    {
+        // Rays from in front of the cluster and from inside it
+        __m128 origin = r % 2 == 0 ? _mm_setr_ps(uniform(rng), uniform(rng), -2.0f, 0) : _mm_setr_ps(5 * uniform(rng), 5 * uniform(rng), 10 + 5 * uniform(rng), 0);
+        __m128 direction = normalized(_mm_setr_ps(0.5f * uniform(rng), 0.5f * uniform(rng), r % 2 == 0 ? 1.0f : uniform(rng), 0));
+        LightRay ray(origin, direction);
+
+        double referenceDistance;
+        int reference = scene.ReferenceHit(ray, referenceDistance);
+        hits += reference >= 0;
+        // Occlusion up to half of the distance to the closest hit must be false, a bit beyond it true
+        float maxDistance = reference >= 0 ? (r % 3 == 0 ? 0.5f * (float)referenceDistance : (float)referenceDistance + 0.01f) : 100.0f;
+        bool referenceOccluded = reference >= 0 && referenceDistance < maxDistance;
+        occluded += referenceOccluded;
+
+        for (const KernelTable &table : tables)
+        {
+            INFO(table.name << " ray " << r);
+            const float *hitObject;
+            Collision collision = table.memoryCollision(ray, scene.baked, hitObject);
+            REQUIRE(scene.Index(hitObject) == reference);
+            REQUIRE(collision.valid == (reference >= 0));
+            if (reference >= 0)
+            {
+                REQUIRE(collision.distance == Catch::Approx(referenceDistance).epsilon(1e-4));
+            }
+            REQUIRE(table.memoryOcclusion(ray, scene.baked, maxDistance) == referenceOccluded);
+        }
+    }
+    // The rays cover hits, misses and both occlusion answers
+    REQUIRE(hits > 1000);
+    REQUIRE(hits < 3900);
+    REQUIRE(occluded > 500);
+}
+
+TEST_CASE("Kernel tables of every ISA level quantize and scatter alike", "[kernels]")
+{
+    const std::vector<KernelTable> tables = supported_tables();
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> value(-20.0f, 300.0f);
+
+    // 37 pixels: the 4 and 2 pixel loops and the single pixel tail all run
+    const int count = 37;
+    __m128 row[count];
+    for (__m128 &pixel : row)
+    {
+        pixel = _mm_setr_ps(value(rng), value(rng), value(rng), value(rng));
+    }
+    for (const KernelTable &table : tables)
+    {
+        INFO(table.name);
+        std::vector<int> out(3 * count + 4);
+        table.quantizeRow(row, count, 255, out.data());
+        for (int x = 0; x < count; x++)
+        {
+            alignas(16) float rgb[4];
+            _mm_store_ps(rgb, row[x]);
+            for (int c = 0; c < 3; c++)
+            {
+                REQUIRE(out[3 * x + c] == std::min(std::max((int)rgb[c], 0), 255));
+            }
+        }
+    }
+
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = 0; i < 100; i++)
+    {
+        __m128 normal = normalized(_mm_setr_ps(value(rng), value(rng), value(rng), 0));
+        __m128 incoming = normalized(_mm_setr_ps(value(rng), value(rng), -value(rng), 0));
+        __m128 u1 = _mm_setr_ps(unit(rng), unit(rng), unit(rng), unit(rng));
+        __m128 u2 = _mm_setr_ps(unit(rng), unit(rng), unit(rng), unit(rng));
+        __m128 expected[4];
+        tables[0].diffuseScatter(normal, u1, u2, expected);
+        __m128 expectedSpecular = tables[0].specularScatter(incoming, normal, 0.3f, u1);
+        for (const KernelTable &table : tables)
+        {
+            INFO(table.name);
+            __m128 directions[4];
+            table.diffuseScatter(normal, u1, u2, directions);
+            for (int d = 0; d < 4; d++)
+            {
+                REQUIRE(norm2(_mm_sub_ps(directions[d], expected[d])) < 1e-10f);
+            }
+            REQUIRE(norm2(_mm_sub_ps(table.specularScatter(incoming, normal, 0.3f, u1), expectedSpecular)) < 1e-10f);
+        }
+    }
+}
+
+TEST_CASE("Collision and occlusion queries give the known answers", "[kernels]")
+{
+    // Two spheres on the z axis, the second one hidden behind the first, and a 6x6 plane at z = 20 facing the origin
+    Material material("white", Vec3(1, 1, 1), 0.5f, 0.5f);
+    std::vector<Object *> objects = {new Sphere(Vec3(0, 0, 14), 1.0f, material),
+                                     new Sphere(Vec3(0, 0, 10), 1.0f, material),
+                                     new Plane(Vec3(0, 0, 20), Vec3(0, 0, 0), Vec3(3, 3, 3), material)};
+    BakedScene scene = bake_into_memory(objects);
+    const LightRay forward(_mm_setr_ps(0, 0, 0, 0), _mm_setr_ps(0, 0, 1, 0));
+    const LightRay backward(_mm_setr_ps(0, 0, 0, 0), _mm_setr_ps(0, 0, -1, 0));
+    const LightRay beside(_mm_setr_ps(2.9f, 0, 0, 0), _mm_setr_ps(0, 0, 1, 0));
+    const LightRay outside(_mm_setr_ps(3.1f, 0, 0, 0), _mm_setr_ps(0, 0, 1, 0));
+    const LightRay grazing(_mm_setr_ps(-2.5f, 0, 19.95f, 0), normalized(_mm_setr_ps(1, 0, 0.02f, 0)));
+    const LightRay parallel(_mm_setr_ps(-2.5f, 0, 19.95f, 0), _mm_setr_ps(1, 0, 0, 0));
+
+    for (const KernelTable &table : supported_tables())
+    {
+        INFO(table.name);
+        const float *hitObject;
+
+        // Hit: the front sphere, not the one behind it
+        Collision hit = table.memoryCollision(forward, scene, hitObject);
+        REQUIRE(hit.valid);
+        REQUIRE(hitObject == scene.spheres + 28);
+        REQUIRE(hit.distance == Catch::Approx(9.0f));
+        REQUIRE(getZ(hit.point) == Catch::Approx(9.0f));
+        REQUIRE(getZ(hit.normal) == Catch::Approx(-1.0f));
+
+        // Miss
+        REQUIRE_FALSE(table.memoryCollision(backward, scene, hitObject).valid);
+        REQUIRE(hitObject == nullptr);
+        REQUIRE_FALSE(table.memoryOcclusion(backward, scene, NO_HIT_DISTANCE));
+
+        // A light in front of the sphere is visible, one behind it is occluded
+        REQUIRE_FALSE(table.memoryOcclusion(forward, scene, 5.0f));
+        REQUIRE(table.memoryOcclusion(forward, scene, 9.5f));
+
+        // Past the spheres onto the plane near its edge, the normal faces the ray
+        hit = table.memoryCollision(beside, scene, hitObject);
+        REQUIRE(hitObject == scene.planes);
+        REQUIRE(hit.distance == Catch::Approx(20.0f));
+        REQUIRE(getZ(hit.normal) == Catch::Approx(-1.0f));
+        REQUIRE_FALSE(table.memoryCollision(outside, scene, hitObject).valid);
+        REQUIRE_FALSE(table.memoryOcclusion(outside, scene, NO_HIT_DISTANCE));
+
+        // Grazing hit on the plane from its front, a parallel ray misses it
+        hit = table.memoryCollision(grazing, scene, hitObject);
+        REQUIRE(hitObject == scene.planes);
+        REQUIRE(hit.distance == Catch::Approx(std::sqrt(1.0f + 0.02f * 0.02f) * 2.5f).epsilon(1e-3));
+        REQUIRE(getZ(hit.normal) == Catch::Approx(-1.0f));
+        REQUIRE(table.memoryOcclusion(grazing, scene, NO_HIT_DISTANCE));
+        REQUIRE_FALSE(table.memoryOcclusion(grazing, scene, 2.0f));
+        REQUIRE_FALSE(table.memoryCollision(parallel, scene, hitObject).valid);
+    }
+
+    free_baked_scene(scene);
+    for (Object *object : objects)
+    {
+        delete object;
+    }
+}
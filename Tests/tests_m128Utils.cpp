@@ -70,3 +70,67 @@ TEST_CASE("Random in unit sphere", "[m128Calc]")
         REQUIRE(m128Calc::norm2(randomVec) < 1.0f);
     }
 }
+
+TEST_CASE("Orthonormal basis", "[m128Calc]")
+{
+    __m128i seed = _mm_set_epi32(4321, 8765, 1109, 3121);
+    for (int i = 0; i < 100; i++)
+    {
+        __m128 n = m128Calc::normalized(m128Calc::random_in_unit_sphere(seed));
+        __m128 t, b;
+        m128Calc::orthonormalBasis(n, t, b);
+        REQUIRE(m128Calc::norm2(t) == Catch::Approx(1.0f).margin(1e-4));
+        REQUIRE(m128Calc::norm2(b) == Catch::Approx(1.0f).margin(1e-4));
+        REQUIRE(m128Calc::dot(t, n) == Catch::Approx(0.0f).margin(1e-4));
+        REQUIRE(m128Calc::dot(b, n) == Catch::Approx(0.0f).margin(1e-4));
+        REQUIRE(m128Calc::dot(t, b) == Catch::Approx(0.0f).margin(1e-4));
+    }
+}
+
+TEST_CASE("Vectorized sine and cosine", "[m128Calc]")
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        float t = i / 1000.0f;
+        __m128 s, c;
+        m128Calc::sincos2pi(_mm_set1_ps(t), s, c);
+        REQUIRE(m128Calc::getX(s) == Catch::Approx(std::sin(2 * 3.1415926535 * t)).margin(1e-5));
+        REQUIRE(m128Calc::getX(c) == Catch::Approx(std::cos(2 * 3.1415926535 * t)).margin(1e-5));
+    }
+}
+
+TEST_CASE("Cosine weighted hemisphere", "[m128Calc]")
+{
+    __m128i seed = _mm_set_epi32(17, 23, 42, 1337);
+    __m128 normal = m128Calc::normalized(_mm_setr_ps(0.3f, -0.5f, 0.8f, 0));
+    double cosineSum = 0;
+    const int batches = 2000;
+    for (int i = 0; i < batches; i++)
+    {
+        __m128 u1 = _mm_add_ps(_mm_mul_ps(m128Calc::randomvec(seed), _mm_set1_ps(0.5f)), _mm_set1_ps(0.5f));
+        __m128 u2 = _mm_add_ps(_mm_mul_ps(m128Calc::randomvec(seed), _mm_set1_ps(0.5f)), _mm_set1_ps(0.5f));
+        __m128 directions[4];
+        m128Calc::cosineHemisphere4(normal, u1, u2, directions);
+        for (__m128 direction : directions)
+        {
+            REQUIRE(m128Calc::norm2(direction) == Catch::Approx(1.0f).margin(1e-4));
+            float cosine = m128Calc::dot(direction, normal);
+            REQUIRE(cosine >= -1e-5f);
+            cosineSum += cosine;
+        }
+    }
+    // Mean cosine of a cosine weighted hemisphere is 2/3
+    REQUIRE(cosineSum / (4 * batches) == Catch::Approx(2.0 / 3.0).margin(0.01));
+}
+
+TEST_CASE("Vectorized exponential", "[m128Calc]")
+{
+    for (float x = -20.0f; x <= 20.0f; x += 0.37f)
+    {
+        float e = m128Calc::getX(m128Calc::exp4(_mm_set1_ps(x)));
+        REQUIRE(e == Catch::Approx(std::exp(x)).epsilon(2e-5));
+    }
+    // Far outside the float range the result is clamped, not inf or 0 bits from an overflowing exponent
+    REQUIRE(m128Calc::getX(m128Calc::exp4(_mm_set1_ps(-1e30f))) >= 0.0f);
+    REQUIRE(m128Calc::getX(m128Calc::exp4(_mm_set1_ps(-1e30f))) < 1e-37f);
+}
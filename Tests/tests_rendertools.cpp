@@ -0,0 +1,52 @@
+#include "catch_amalgamated.hpp"
+#include <immintrin.h>
+#include <cstdio>
+
+#include "../Include/tools.h"
+#include "../Include/rendersettings.h"
+#include "../Include/rendertools.h"
+
+TEST_CASE("Checkpoints round trip and reject other renders", "[checkpoint]")
+{
+    const int width = 5;
+    const int height = 4;
+    const std::string path = "tests_checkpoint.accum";
+    RenderSettings settings({width, height}, "render.ppm", 8);
+    settings.bounces = 3;
+    settings.scatterbase = 4;
+    settings.scatterredux = 1;
+    const uint32_t key = checkpoint_key("Scenes/cornell.scene", settings);
+
+    __m128 saved[width * height];
+    for (int p = 0; p < width * height; p++)
+    {
+        saved[p] = _mm_setr_ps((float)p, 0.5f * p, 2.0f, 7.0f);
+    }
+    REQUIRE(save_checkpoint(path, saved, width, height, 12, key));
+
+    __m128 loaded[width * height];
+    int passes = 0;
+    REQUIRE(load_checkpoint(path, loaded, width, height, passes, key));
+    REQUIRE(passes == 12);
+    for (int p = 0; p < width * height; p++)
+    {
+        REQUIRE(_mm_movemask_ps(_mm_cmpeq_ps(loaded[p], saved[p])) == 0xF);
+    }
+
+    // Output settings do not matter, the scene, the sampling settings and the resolution do
+    RenderSettings output = settings;
+    output.channel_depth = 16;
+    output.denoise = true;
+    REQUIRE(checkpoint_key("Scenes/cornell.scene", output) == key);
+    RenderSettings bounces = settings;
+    bounces.bounces = 4;
+    RenderSettings scatter = settings;
+    scatter.scatterredux = 2;
+    REQUIRE_FALSE(load_checkpoint(path, loaded, width, height, passes, checkpoint_key("Scenes/other.scene", settings)));
+    REQUIRE_FALSE(load_checkpoint(path, loaded, width, height, passes, checkpoint_key("Scenes/cornell.scene", bounces)));
+    REQUIRE_FALSE(load_checkpoint(path, loaded, width, height, passes, checkpoint_key("Scenes/cornell.scene", scatter)));
+    REQUIRE_FALSE(load_checkpoint(path, loaded, width, height + 1, passes, key));
+    REQUIRE_FALSE(load_checkpoint("tests_missing.accum", loaded, width, height, passes, key));
+
+    std::remove(path.c_str());
+}
@@ -0,0 +1,143 @@
+#define CATCH_CONFIG_MAIN
+#include "catch_amalgamated.hpp"
+#include "../Include/sampler.h"
+#include "../Include/m128Utils.h"
+#include <immintrin.h>
+
+using namespace Catch;
+
+TEST_CASE("Sampler values are in the unit interval", "[Sampler]")
+{
+    Sampler sampler(3, 7);
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+        sampler.StartSample(i);
+        for (int d = 0; d < 4; d++)
+        {
+            alignas(16) float u[4];
+            _mm_store_ps(u, sampler.Next());
+            for (float value : u)
+            {
+                REQUIRE(value >= 0.0f);
+                REQUIRE(value < 1.0f);
+            }
+        }
+    }
+}
+
+TEST_CASE("Sampler is stratified over the samples of a pixel", "[Sampler]")
+{
+    // 64 samples into 64 bins: the Sobol sequence puts exactly one sample into every bin, also after the rotation
+    const int n = 64;
+    Sampler sampler(12, 34);
+    int bins[3][4][n] = {};
+    for (int i = 0; i < n; i++)
+    {
+        sampler.StartSample(i);
+        for (int d = 0; d < 3; d++)
+        {
+            alignas(16) float u[4];
+            _mm_store_ps(u, sampler.Next());
+            for (int lane = 0; lane < 4; lane++)
+            {
+                bins[d][lane][(int)(u[lane] * n)]++;
+            }
+        }
+    }
+    for (int d = 0; d < 3; d++)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            // Independent random numbers would leave about n / e bins empty
+            for (int b = 0; b < n; b++)
+            {
+                REQUIRE(bins[d][lane][b] == 1);
+            }
+        }
+    }
+}
+
+TEST_CASE("Sampler decorrelates pixels and dimensions", "[Sampler]")
+{
+    // Pairs of the same lane from two groups of a sample must fill the unit square. Groups that are shifted copies
+    // of each other put all pairs on a few lines and leave most cells of the grid empty
+    const int n = 4096;
+    const int cells = 16;
+    for (int pixel = 0; pixel < 4; pixel++)
+    {
+        Sampler sampler(pixel * 5, 3);
+        for (int group = 1; group < 3; group++)
+        {
+            int grid[cells][cells] = {};
+            for (int i = 0; i < n; i++)
+            {
+                sampler.StartSample(i);
+                alignas(16) float first[4], other[4];
+                _mm_store_ps(first, sampler.Next());
+                for (int g = 1; g <= group; g++)
+                {
+                    _mm_store_ps(other, sampler.Next());
+                }
+                grid[(int)(first[0] * cells)][(int)(other[0] * cells)]++;
+            }
+            // 16 pairs per cell on average
+            for (int cx = 0; cx < cells; cx++)
+            {
+                for (int cy = 0; cy < cells; cy++)
+                {
+                    REQUIRE(grid[cx][cy] > 2);
+                    REQUIRE(grid[cx][cy] < 40);
+                }
+            }
+        }
+    }
+
+    Sampler a(0, 0);
+    Sampler b(1, 0);
+    __m128 a0 = a.Next();
+    __m128 b0 = b.Next();
+    REQUIRE(_mm_movemask_ps(_mm_cmpeq_ps(a0, b0)) != 0xF);
+
+    // Restarting a sample gives the same values
+    a.StartSample(0);
+    REQUIRE(_mm_movemask_ps(_mm_cmpeq_ps(a.Next(), a0)) == 0xF);
+}
+
+TEST_CASE("Diffuse directions of a pixel sample sequence are cosine distributed", "[Sampler]")
+{
+    // Dimensions are used like in Camera::FullTrace: subpixel jitter first, then two groups for four diffuse directions
+    const int n = 4096;
+    const __m128 normal = m128Calc::normalized(_mm_setr_ps(0.3f, 1.0f, -0.2f, 0.0f));
+    for (int pixel = 0; pixel < 4; pixel++)
+    {
+        Sampler sampler(pixel, 2 * pixel + 1);
+        double cosine[4] = {};
+        double cross[2] = {};
+        for (int i = 0; i < n; i++)
+        {
+            sampler.StartSample(i);
+            sampler.Next();
+            __m128 a = sampler.Next();
+            __m128 b = sampler.Next();
+            __m128 directions[4];
+            m128Calc::cosineHemisphere4(normal,
+                                        _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+                                        _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)),
+                                        directions);
+            for (int d = 0; d < 4; d++)
+            {
+                cosine[d] += m128Calc::dot(directions[d], normal);
+            }
+            // Directions from different groups are independent, E[w0 . w2] = E[w0] . E[w2] = (2/3)^2
+            cross[0] += m128Calc::dot(directions[0], directions[2]);
+            cross[1] += m128Calc::dot(directions[1], directions[3]);
+        }
+        // Mean cosine of a cosine distributed direction is 2/3
+        for (int d = 0; d < 4; d++)
+        {
+            REQUIRE(cosine[d] / n == Approx(2.0 / 3.0).margin(0.01));
+        }
+        REQUIRE(cross[0] / n == Approx(4.0 / 9.0).margin(0.02));
+        REQUIRE(cross[1] / n == Approx(4.0 / 9.0).margin(0.02));
+    }
+}
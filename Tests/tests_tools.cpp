@@ -97,4 +97,32 @@ TEST_CASE("String to Vec", "[XML]")
     REQUIRE(v.x() == Approx(0.123f));
     REQUIRE(v.y() == Approx(1.234f));
     REQUIRE(v.z() == Approx(2.345f));
-}
\ No newline at end of file
+}
+
+TEST_CASE("Skybox LUT matches gradient", "[Skybox]")
+{
+    alignas(16) __m128 colors[3] = {Vec3(0, 0, 0).data, Vec3(1, 0.5f, 0).data, Vec3(0, 0, 1).data};
+    std::vector<float> marks = {0.0f, 0.3f, 1.0f};
+    SkyboxLUT lut;
+    lut.Bake(colors, marks);
+
+    for (float y = -1.0f; y <= 1.0f; y += 0.01f)
+    {
+        __m128 expected = get_gradient(colors, marks, y * 0.5f + 0.5f);
+        __m128 actual = lut.Lookup(_mm_setr_ps(0, y, 0, 0));
+        REQUIRE(Vec3(actual).x() == Approx(Vec3(expected).x()).margin(0.01f));
+        REQUIRE(Vec3(actual).y() == Approx(Vec3(expected).y()).margin(0.01f));
+        REQUIRE(Vec3(actual).z() == Approx(Vec3(expected).z()).margin(0.01f));
+    }
+}
+
+TEST_CASE("Skybox LUT clamps out of range directions", "[Skybox]")
+{
+    alignas(16) __m128 colors[2] = {Vec3(1, 0, 0).data, Vec3(0, 0, 1).data};
+    std::vector<float> marks = {0.0f, 1.0f};
+    SkyboxLUT lut;
+    lut.Bake(colors, marks);
+
+    REQUIRE(Vec3(lut.Lookup(_mm_setr_ps(0, 1.5f, 0, 0))).z() == Approx(1.0f));
+    REQUIRE(Vec3(lut.Lookup(_mm_setr_ps(0, -1.5f, 0, 0))).x() == Approx(1.0f));
+}
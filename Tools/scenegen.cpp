@@ -0,0 +1,398 @@
+// Procedural scene generator for scalability tests. Usage:
+//   scenegen <output.scene> [--objects=n] [--planes=n] [--distribution=uniform|clustered|layered]
+//            [--mix=matte:6,glossy:3,mirror:1,light:0] [--seed=n] [--binary]
+// The same arguments always produce the same scene. With --binary the objects are written
+// as a baked object file (<output>.baked) and the scene file only references it, so even 10M objects load without parsing.
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+
+#include "../Include/tools.h"
+#include "../Include/m128Utils.h"
+#include "../Include/lightray.h"
+#include "../Include/trace.h"
+#include "../Include/materials.h"
+#include "../Include/objects.h"
+#include "../Include/memprep.h"
+
+/// @brief Material classes of the mix, each in SCENEGEN_COLORS colors
+const char *SCENEGEN_CLASSES[] = {"matte", "glossy", "mirror", "light"};
+const int SCENEGEN_CLASS_COUNT = 4;
+const float SCENEGEN_REFLECTION[] = {0.1f, 0.6f, 1.0f, 0.3f};
+/// @brief Negative roughness makes a material emissive
+const float SCENEGEN_ROUGHNESS[] = {0.9f, 0.3f, 0.05f, -1.0f};
+const int SCENEGEN_COLORS = 4;
+const float SCENEGEN_PALETTE[SCENEGEN_COLORS][3] = {{0.8f, 0.2f, 0.2f}, {0.2f, 0.7f, 0.3f}, {0.2f, 0.3f, 0.8f}, {0.85f, 0.85f, 0.85f}};
+const float SCENEGEN_LIGHT_STRENGTH = 4.0f;
+
+/// @brief splitmix64, unlike the std distributions it gives the same numbers with every standard library
+struct SceneRandom
+{
+    uint64_t state;
+
+    uint64_t Next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    /// @brief Uniform in [0, 1)
+    float Uniform() { return (Next() >> 40) * (1.0f / 16777216.0f); }
+
+    float Range(float min, float max) { return min + (max - min) * Uniform(); }
+
+    /// @brief Standard normal distribution (Box-Muller)
+    float Gaussian()
+    {
+        float u1 = 1.0f - Uniform();
+        float u2 = Uniform();
+        return std::sqrt(-2.0f * std::log(u1)) * std::cos(6.2831853f * u2);
+    }
+};
+
+/// @brief Rounded to the 3 decimals of the scene file and read back like the scene parser does,
+/// so the .scene and the .baked version of a scene render identically
+inline float quantize(float value)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", value);
+    return std::stof(text);
+}
+
+struct GeneratorSettings
+{
+    std::string outputPath;
+    long long objects = 1000;
+    int planes = 1;
+    std::string distribution = "uniform";
+    /// @brief Weight of every material class, SCENEGEN_CLASSES order
+    float mix[SCENEGEN_CLASS_COUNT] = {6, 3, 1, 0};
+    uint64_t seed = 1;
+    bool binary = false;
+};
+
+/// @brief Generated scene, objects are written directly and never kept in memory all at once
+class SceneGenerator
+{
+private:
+    const GeneratorSettings &settings;
+    SceneRandom random;
+    std::vector<Material> materials;
+    /// @brief Cumulative weights of the material classes
+    float mixSum[SCENEGEN_CLASS_COUNT];
+
+    /// @brief Bounding box of the sphere centers: x and z in [-halfWidth, halfWidth], y in [1, 1 + height]
+    float halfWidth;
+    float height;
+    /// @brief Cluster centers of the clustered distribution
+    std::vector<Vec3> clusters;
+    float clusterSpread;
+    int layers;
+
+public:
+    SceneGenerator(const GeneratorSettings &settings) : settings(settings)
+    {
+        random.state = settings.seed;
+
+        float sum = 0;
+        for (int c = 0; c < SCENEGEN_CLASS_COUNT; c++)
+        {
+            sum += std::max(settings.mix[c], 0.0f);
+            mixSum[c] = sum;
+            for (int i = 0; i < SCENEGEN_COLORS; i++)
+            {
+                float strength = c == 3 ? SCENEGEN_LIGHT_STRENGTH : 1.0f;
+                Vec3 color(SCENEGEN_PALETTE[i][0] * strength, SCENEGEN_PALETTE[i][1] * strength, SCENEGEN_PALETTE[i][2] * strength);
+                materials.push_back(Material(std::string(SCENEGEN_CLASSES[c]) + "_" + std::to_string(i), color, SCENEGEN_REFLECTION[c], SCENEGEN_ROUGHNESS[c]));
+            }
+        }
+        if (sum <= 0)
+        {
+            std::cerr << "SCENEGEN ERROR: MATERIAL MIX IS EMPTY, USING MATTE" << std::endl;
+            for (int c = 0; c < SCENEGEN_CLASS_COUNT; c++)
+            {
+                mixSum[c] = 1;
+            }
+        }
+
+        // Constant density: about 8 cubic units per sphere
+        const double count = (double)std::max(settings.objects, 1LL);
+        if (settings.distribution == "layered")
+        {
+            layers = (int)std::min(8.0, count);
+            halfWidth = (float)std::sqrt(count / layers);
+            height = 3.0f * (layers - 1);
+        }
+        else
+        {
+            halfWidth = (float)std::cbrt(count);
+            height = 2 * halfWidth;
+        }
+        if (settings.distribution == "clustered")
+        {
+            // About 1000 spheres per cluster
+            int clusterCount = (int)std::max(1.0, count / 1000);
+            for (int c = 0; c < clusterCount; c++)
+            {
+                clusters.push_back(Vec3(random.Range(-halfWidth, halfWidth), random.Range(1, 1 + height), random.Range(-halfWidth, halfWidth)));
+            }
+            clusterSpread = 0.1f * halfWidth / (float)std::cbrt((double)clusterCount) + 1.0f;
+        }
+    }
+
+    const std::vector<Material> &Materials() const { return materials; }
+
+    /// @brief Next sphere of the distribution
+    Sphere NextSphere(long long index)
+    {
+        Vec3 position;
+        if (settings.distribution == "clustered")
+        {
+            const Vec3 &center = clusters[index % clusters.size()];
+            position = Vec3(center.x() + clusterSpread * random.Gaussian(), std::max(center.y() + clusterSpread * random.Gaussian(), 0.7f),
+                            center.z() + clusterSpread * random.Gaussian());
+        }
+        else if (settings.distribution == "layered")
+        {
+            int layer = (int)(index % layers);
+            position = Vec3(random.Range(-halfWidth, halfWidth), 1 + 3.0f * layer + random.Range(-0.2f, 0.2f), random.Range(-halfWidth, halfWidth));
+        }
+        else
+        {
+            position = Vec3(random.Range(-halfWidth, halfWidth), random.Range(1, 1 + height), random.Range(-halfWidth, halfWidth));
+        }
+        position = Vec3(quantize(position.x()), quantize(position.y()), quantize(position.z()));
+        float radius = quantize(random.Range(0.2f, 0.6f));
+        return Sphere(position, radius, NextMaterial());
+    }
+
+    /// @brief The first plane is the ground under everything, the others are panels at random places and angles
+    /// @param rotation Set to the rotation in degrees, as written to the scene file
+    Plane NextPlane(int index, Vec3 &rotation)
+    {
+        const float extent = halfWidth + 2;
+        if (index == 0)
+        {
+            rotation = Vec3(90, 0, 0);
+            return Plane(Vec3(0, 0, 0), rotation.eulerToRad(), Vec3(quantize(extent), quantize(extent), quantize(extent)), materials[SCENEGEN_COLORS - 1]);
+        }
+        Vec3 position(quantize(random.Range(-extent, extent)), quantize(random.Range(1, 1 + height)), quantize(random.Range(-extent, extent)));
+        rotation = Vec3(quantize(random.Range(0, 180)), quantize(random.Range(0, 180)), 0);
+        float size = quantize(random.Range(0.5f, 2.0f));
+        return Plane(position, rotation.eulerToRad(), Vec3(size, size, size), NextMaterial());
+    }
+
+    /// @brief Camera outside the bounding box looking at its center
+    void WriteCamera(std::ostream &file) const
+    {
+        float centerY = 1 + height / 2;
+        float distance = std::max(halfWidth, height / 2) * 2.5f + 5;
+        file << "    <camera position=\"" << 0.6f * distance << ", " << centerY + 0.4f * distance << ", " << -distance
+             << "\" lookAt=\"0, " << centerY << ", 0\" fieldOfView=\"45\" skybox=\"true\"/>\n";
+    }
+
+private:
+    const Material &NextMaterial()
+    {
+        float pick = random.Uniform() * mixSum[SCENEGEN_CLASS_COUNT - 1];
+        int c = 0;
+        while (c < SCENEGEN_CLASS_COUNT - 1 && pick >= mixSum[c])
+        {
+            c++;
+        }
+        return materials[c * SCENEGEN_COLORS + (int)(random.Next() % SCENEGEN_COLORS)];
+    }
+};
+
+void write_vec3(std::ostream &file, __m128 v)
+{
+    file << getX(v) << ", " << getY(v) << ", " << getZ(v);
+}
+
+/// @brief Objects as XML, the format of the handwritten scenes
+void write_objects_xml(std::ostream &file, SceneGenerator &generator, const GeneratorSettings &settings)
+{
+    for (long long i = 0; i < settings.objects; i++)
+    {
+        Sphere sphere = generator.NextSphere(i);
+        file << "        <Sphere position=\"";
+        write_vec3(file, sphere.position);
+        file << "\" radius=\"" << getX(sphere.scale) << "\" material=\"" << sphere.mat.id << "\" />\n";
+    }
+    for (int i = 0; i < settings.planes; i++)
+    {
+        Vec3 rotation;
+        Plane plane = generator.NextPlane(i, rotation);
+        file << "        <Plane position=\"";
+        write_vec3(file, plane.position);
+        file << "\" rotation=\"";
+        write_vec3(file, rotation.data);
+        file << "\" scale=\"";
+        write_vec3(file, plane.scale);
+        file << "\" material=\"" << plane.mat.id << "\" />\n";
+    }
+}
+
+/// @brief Objects as baked object file, see BakedFileHeader. Object ids follow the order of the XML version
+bool write_objects_baked(const std::string &path, SceneGenerator &generator, const GeneratorSettings &settings)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "SCENEGEN ERROR: UNABLE TO WRITE " << path << std::endl;
+        return false;
+    }
+    BakedFileHeader header = make_baked_header(settings.objects, settings.planes);
+    file.write((const char *)&header, sizeof(header));
+
+    alignas(16) float slot[28] = {};
+    for (long long i = 0; i < settings.objects; i++)
+    {
+        Sphere sphere = generator.NextSphere(i);
+        bake_object(slot, &sphere, (int32_t)(i + 1));
+        file.write((const char *)slot, sizeof(slot));
+    }
+    for (int i = 0; i < settings.planes; i++)
+    {
+        Vec3 rotation;
+        Plane plane = generator.NextPlane(i, rotation);
+        bake_object(slot, &plane, (int32_t)(settings.objects + i + 1));
+        file.write((const char *)slot, sizeof(slot));
+    }
+    return true;
+}
+
+/// @brief Parses --mix=class:weight,...; classes that are not listed get weight 0
+bool parse_mix(const std::string &value, float *mix)
+{
+    std::fill(mix, mix + SCENEGEN_CLASS_COUNT, 0.0f);
+    std::stringstream ss(value);
+    std::string entry;
+    while (std::getline(ss, entry, ','))
+    {
+        size_t colon = entry.find(':');
+        std::string name = entry.substr(0, colon);
+        int c = 0;
+        while (c < SCENEGEN_CLASS_COUNT && name != SCENEGEN_CLASSES[c])
+        {
+            c++;
+        }
+        if (c == SCENEGEN_CLASS_COUNT || colon == std::string::npos)
+        {
+            std::cerr << "ARGUMENT ERROR: UNKNOWN MATERIAL CLASS " << entry << std::endl;
+            return false;
+        }
+        const char *weight = entry.c_str() + colon + 1;
+        char *end;
+        mix[c] = std::strtof(weight, &end);
+        if (end == weight || *end != '\0' || !(mix[c] >= 0))
+        {
+            std::cerr << "ARGUMENT ERROR: INVALID MATERIAL WEIGHT " << entry << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "No argument provided. Usage: scenegen <output.scene> [--objects=n] [--planes=n] [--distribution=uniform|clustered|layered] "
+                     "[--mix=matte:6,glossy:3,mirror:1,light:0] [--seed=n] [--binary]"
+                  << std::endl;
+        return 1;
+    }
+
+    GeneratorSettings settings;
+    settings.outputPath = argv[1];
+    for (int i = 2; i < argc; i++)
+    {
+        std::string flag = argv[i];
+        if (flag.rfind("--objects=", 0) == 0)
+        {
+            settings.objects = std::max(std::atoll(flag.c_str() + 10), 0LL);
+        }
+        else if (flag.rfind("--planes=", 0) == 0)
+        {
+            settings.planes = std::max(std::atoi(flag.c_str() + 9), 0);
+        }
+        else if (flag.rfind("--distribution=", 0) == 0 &&
+                 (flag.substr(15) == "uniform" || flag.substr(15) == "clustered" || flag.substr(15) == "layered"))
+        {
+            settings.distribution = flag.substr(15);
+        }
+        else if (flag.rfind("--mix=", 0) == 0)
+        {
+            if (!parse_mix(flag.substr(6), settings.mix))
+            {
+                return 1;
+            }
+        }
+        else if (flag.rfind("--seed=", 0) == 0)
+        {
+            settings.seed = std::strtoull(flag.c_str() + 7, nullptr, 10);
+        }
+        else if (flag == "--binary")
+        {
+            settings.binary = true;
+        }
+        else
+        {
+            std::cerr << "ARGUMENT ERROR: UNKNOWN FLAG " << flag << std::endl;
+            return 1;
+        }
+    }
+
+    std::ofstream file(settings.outputPath);
+    if (!file.is_open())
+    {
+        std::cerr << "SCENEGEN ERROR: UNABLE TO WRITE " << settings.outputPath << std::endl;
+        return 1;
+    }
+    file << std::fixed << std::setprecision(3);
+
+    SceneGenerator generator(settings);
+    file << "<scene>\n    <materials>\n";
+    for (const Material &material : generator.Materials())
+    {
+        file << "        <material id=\"" << material.id << "\" color=\"";
+        write_vec3(file, material.color);
+        file << "\" reflection=\"" << material.intensity << "\" roughness=\"" << material.diffuse << "\" />\n";
+    }
+    file << "    </materials>\n    <objects>\n";
+
+    if (settings.binary)
+    {
+        // The baked file sits next to the scene file, scene paths are relative to the scene folder
+        std::string bakedPath = settings.outputPath.substr(0, settings.outputPath.find_last_of('.')) + ".baked";
+        size_t separator = bakedPath.find_last_of("/\\");
+        if (!write_objects_baked(bakedPath, generator, settings))
+        {
+            return 1;
+        }
+        file << "        <Baked path=\"" << (separator == std::string::npos ? bakedPath : bakedPath.substr(separator + 1)) << "\" />\n";
+    }
+    else
+    {
+        write_objects_xml(file, generator, settings);
+    }
+
+    file << "    </objects>\n";
+    generator.WriteCamera(file);
+    file << "</scene>\n";
+
+    std::cout << "Generated " << settings.objects << " spheres and " << settings.planes << " planes (" << settings.distribution << ")" << std::endl;
+    return 0;
+}
@@ -6,18 +6,31 @@
 #include "Include/lightray.h"
 #include "Include/rendersettings.h"
 #include "Include/rendertools.h"
+#include "Include/trace.h"
+#include "Include/video.h"
 #include "Include/materials.h"
 #include "Include/objects.h"
+#include "Include/animation.h"
 #include "Include/scene.h"
 #include "Include/memprep.h"
+#include "Include/profile.h"
+#include "Include/stats.h"
+#include "Include/cpudispatch.h"
+#include "Include/envmap.h"
+#include "Include/lights.h"
+#include "Include/sampler.h"
+#include "Include/denoiser.h"
+#include "Include/aov.h"
 #include "Include/camera.h"
 
-void Scene::ParseCamera(std::map<std::string, std::string> camParams)
+void Scene::ParseCamera(std::map<std::string, std::string> camParams, std::vector<string> gradientStrings)
 {
     Vec3 position;
     Vec3 lookAt;
     float fov = 45;
     bool skybox = false;
+    std::string environment = "";
+    float environmentIntensity = 1.0f;
 
     for (const auto &[key, value] : camParams)
     {
@@ -37,12 +50,76 @@ void Scene::ParseCamera(std::map<std::string, std::string> camParams)
         {
             skybox = (value == "true");
         }
+        else if (key == "environment")
+        {
+            environment = value;
+        }
+        else if (key == "environmentIntensity")
+        {
+            environmentIntensity = std::stof(value);
+        }
         else
         {
             std::cerr << "SCENE ERROR: CAMERA PARAMETER " << key << std::endl;
         }
     }
-    this->cam = new Camera(position, lookAt, fov, this->rs, *this, skybox);
+
+    // Optional skybox gradient: <gradient mark="m" color="r, g, b" />
+    std::vector<float> marks;
+    std::vector<Vec3> colors;
+    for (std::string gradient : gradientStrings)
+    {
+        XML_Node current_gradient = parse_xml_bracket(gradient);
+        if (current_gradient.tag_name != "gradient")
+        {
+            std::cerr << "SCENE ERROR: UNKNOWN CAMERA TAG " << current_gradient.tag_name << std::endl;
+            continue;
+        }
+        float mark = 0;
+        Vec3 color;
+        for (const auto &[key, value] : current_gradient.parameters)
+        {
+            if (key == "mark")
+            {
+                mark = std::stof(value);
+            }
+            else if (key == "color")
+            {
+                color = parseVec3(value);
+            }
+            else
+            {
+                std::cerr << "SCENE ERROR: UNKNOWN GRADIENT PARAMETER " << key << std::endl;
+            }
+        }
+        marks.push_back(mark);
+        colors.push_back(color);
+    }
+
+    if (!marks.empty())
+    {
+        // Sort by mark and extend the gradient to cover [0, 1]
+        auto [order, sortedMarks] = sortWithIndex(marks);
+        std::vector<Vec3> sortedColors;
+        for (size_t i : order)
+        {
+            sortedColors.push_back(colors[i]);
+        }
+        if (sortedMarks.front() > 0.0f)
+        {
+            sortedMarks.insert(sortedMarks.begin(), 0.0f);
+            sortedColors.insert(sortedColors.begin(), sortedColors.front());
+        }
+        if (sortedMarks.back() < 1.0f)
+        {
+            sortedMarks.push_back(1.0f);
+            sortedColors.push_back(sortedColors.back());
+        }
+        marks = sortedMarks;
+        colors = sortedColors;
+    }
+
+    this->cam = new Camera(position, lookAt, fov, this->rs, *this, skybox, marks, colors, environment, environmentIntensity);
 }
 
 void Scene::cleanup()
@@ -63,14 +140,50 @@ int main(int argc, char *argv[])
 {
     if (argc < 3)
     {
-        std::cerr << "No argument provided. Usage: renderer.exe <scene_path> <rendersetttings_path>" << std::endl;
+        std::cerr << "No argument provided. Usage: renderer.exe <scene_path> <rendersetttings_path> [--isa=sse4.1|avx2|avx512]" << std::endl;
         return 1;
     }
 
+    // Optional flags
+    IsaLevel forcedIsa;
+    bool forceIsa = false;
+    for (int i = 3; i < argc; i++)
+    {
+        std::string flag = argv[i];
+        if (flag.rfind("--isa=", 0) == 0 && ParseIsaLevel(flag.substr(6), forcedIsa))
+        {
+            forceIsa = true;
+        }
+        else
+        {
+            std::cerr << "ARGUMENT ERROR: UNKNOWN FLAG " << flag << std::endl;
+        }
+    }
+
+    // The settings decide whether to trace, their parsing is recorded afterwards
+    double parseStart = omp_get_wtime();
     RenderSettings rendersettings = RenderSettings(argv[2]);
+    if (!rendersettings.trace_path.empty())
+    {
+        tracer.Enable(parseStart);
+        tracer.Record("parse settings", "setup", parseStart, omp_get_wtime());
+    }
+    // Before the first console output, video on stdout moves the console to stderr
+    if (!videoOutput.Open(rendersettings))
+    {
+        return 1;
+    }
+    SelectKernels(forceIsa ? &forcedIsa : nullptr);
+    double sceneStart = omp_get_wtime();
     Scene testscene = Scene(argv[1], rendersettings);
+    tracer.Record("parse scene", "setup", sceneStart, omp_get_wtime());
 
-    testscene.cam->RenderImage(Camera::kernel_full);
+    testscene.cam->RenderFull();
+    videoOutput.Close();
+    if (tracer.Enabled())
+    {
+        tracer.Write(rendersettings.trace_path);
+    }
     testscene.cleanup();
     return 0;
 }
@@ -1,7 +1,6 @@
 from __future__ import annotations
 
 import subprocess
-import os
 import math
 import random
 import time
@@ -80,7 +79,10 @@ def xml_sphere(position, radius, material_id):
 def xml_camera(position, lookAt, fieldOfView):
     return f'<camera position="{position.x}, {position.y}, {position.z}" lookAt="{lookAt.x}, {lookAt.y}, {lookAt.z}" fieldOfView="{fieldOfView}" skybox="true"/>'
 
-def xml_root(materials, objects, camera):
+def xml_animation(frames, stream):
+    return f'<animation frames="{frames}" stream="{stream}" />'
+
+def xml_root(materials, objects, camera, animation):
     return  f"""<scene>
     <materials>
         {materials}
@@ -88,6 +90,7 @@ def xml_root(materials, objects, camera):
     <objects>
         {objects}
     </objects>
+    {animation}
     {camera}
 </scene>"""
 
@@ -104,7 +107,7 @@ def update_positions(iteration, timestep):
         for j in range(i+1, len(balls)):
             balls[i].resolve_collision(balls[j])
 
-def build_xml(iteration, materials, balls):
+def build_xml(materials, balls, frames, stream):
     x_mats = [xml_material(m.id, m.color, m.reflection, m.roughness) for m in materials]
     x_mats.append(xml_material(base_mat.id, base_mat.color, base_mat.reflection, base_mat.roughness))
     x_balls = [xml_sphere(s.position, s.size, s.mat) for s in balls]
@@ -113,9 +116,14 @@ def build_xml(iteration, materials, balls):
     return xml_root(
         merge(x_mats),
         merge(x_balls),
-        x_cam
+        x_cam,
+        xml_animation(frames, stream)
     )
 
+def transform_lines(frame, balls):
+    # Object ids count from 1 in scene file order, the balls come first
+    return [f"{frame} {i+1} {b.position.x} {b.position.y} {b.position.z}\n" for i, b in enumerate(balls)]
+
 class Ball:
     def __init__(self, position: vec3, velocity: vec3, size, materialID, mass):
         self.position = position
@@ -210,31 +218,28 @@ for m in range(len(materials)):
     )
     balls.append(newball)
 
-starttime = time.time()
-for i in range(FRAME_COUNT):
-    print(f"\n[{time.time()-starttime:.1f}s] Rendering Frame {i+1}/{FRAME_COUNT}")
-    update_positions(i, TIMESCALE/FPS)
-    data = build_xml(i, materials, balls)
-    
-    # Write scene information to a file
-    with open("movie.scene", "w") as file:
-        file.write(data + "\n")
-    
-    exe_path = ".\\Build\\main.exe"
-    process = subprocess.Popen([exe_path, "movie.scene", "Templates/settings_quality.xml"], shell=True)
-    process.wait()
-    
-    # Rename the output image to include the iteration number
-    output_image = f"render_{i:04d}.ppm"
-    os.rename("render.ppm", output_image)
-
-# Combine the .ppm images into an .mp4 video using ffmpeg
-output_video = "output_video.mp4"
-image_files = [f"render_{i:04d}.ppm" for i in range(FRAME_COUNT)]
+# Simulate all frames first, the renderer reads the positions from the transform stream
+# and renders every frame in one run without parsing and baking the scene again
+TRANSFORM_STREAM = "movie_transforms.txt"
+with open(TRANSFORM_STREAM, "w") as file:
+    file.write("# frame object x y z\n")
+    for i in range(FRAME_COUNT):
+        update_positions(i, TIMESCALE/FPS)
+        file.writelines(transform_lines(i, balls))
 
-os.system(f"ffmpeg -y -r {FPS} -i render_%04d.ppm -c:v libx264 -pix_fmt yuv420p {output_video} -loglevel error -hide_banner")
+with open("movie.scene", "w") as file:
+    file.write(build_xml(materials, balls, FRAME_COUNT, TRANSFORM_STREAM) + "\n")
 
-for ppm_file in image_files:
-    os.remove(ppm_file)
+# The frames go straight from the renderer into the encoder, no image files are written
+output_video = "output_video.mp4"
+encoder = f"ffmpeg -y -loglevel error -hide_banner -f rawvideo -pix_fmt {{format}} -s {{width}}x{{height}} -r {{fps}} -i - -c:v libx264 -pix_fmt yuv420p {output_video}"
+with open("Templates/settings_quality.xml") as file:
+    settings = file.read()
+with open("movie_settings.xml", "w") as file:
+    file.write(settings.replace("</rendersettings>", f'    <video command="{encoder}" fps="{FPS}" />\n</rendersettings>'))
 
-print(f"Video saved as {output_video}")
\ No newline at end of file
+starttime = time.time()
+exe_path = ".\\Build\\main.exe"
+process = subprocess.Popen([exe_path, "movie.scene", "movie_settings.xml"], shell=True)
+process.wait()
+print(f"\nRendered {FRAME_COUNT} frames into {output_video} in {time.time()-starttime:.1f}s")